@@ -9,6 +9,8 @@
 typedef struct alphahttpd alphahttpd;
 typedef struct alphahttpd_client alphahttpd_client;
 struct alphahttpd_filter;
+struct ahd_ocache;
+struct qsbr;
 
 enum ALPHAHTTPD_LOG {
 	ALPHAHTTPD_LOG_SYSFATAL,
@@ -27,6 +29,16 @@ struct alphahttpd_address {
 	ffuint port;
 };
 
+/** A blocking operation executed by a kcall thread */
+struct alphahttpd_task {
+	void (*run)(void *param);
+	void *param;
+
+	/** Called by the kcall thread after run(): passes the task back to the worker */
+	void (*complete)(struct alphahttpd_task *t);
+	void *complete_param;
+};
+
 struct alphahttpd_conf {
 	void *opaque;
 	ffuint log_level;
@@ -37,15 +49,42 @@ struct alphahttpd_conf {
 	If NULL, KCQ mechanism will be disabled. */
 	void (*kcq_set)(void *opaque, struct ffkcallqueue *kcq);
 
+	/** Execute the task on a kcall thread (requires kcq_set).
+	If NULL, the tasks are executed by the worker synchronously.
+	Return 0 on success */
+	int (*task_post)(void *opaque, struct alphahttpd_task *t);
+
 	struct {
 		const struct alphahttpd_address *listen_addresses;
 		ffuint max_connections;
+
+		/** Max. number of new connections accepted per event loop iteration (0: no limit).
+		Already accepted clients are served before the server accepts more. */
+		ffuint accept_budget;
+
 		ffuint events_num;
 		ffuint fdlimit_timeout_sec;
+
+		/** Max. total size of unused receive/response/file buffers kept by each worker for reuse */
+		ffuint buffer_pool_max;
+
 		ffuint timer_interval_msec;
 		ffuint _conn_id_counter_default;
 		ffuint *conn_id_counter;
 		ffbyte polling_mode;
+
+		/** Adaptive polling: after the last activity busy-poll for this time (in microseconds),
+		 then fall back to blocking waits (0: disabled).
+		Applies to both workers' event loops and kcall workers.  Not used with polling_mode. */
+		ffuint polling_usec;
+
+		/** Linux: use io_uring for socket I/O, accepting connections and timer.
+		Falls back to the default mechanism if io_uring isn't supported by kernel. */
+		ffbyte io_uring;
+
+		/** Shared by workers: tracks when workers stop using lock-free shared data.
+		Set by alphahttpd_filter_file_ocache_init(). */
+		struct qsbr *qsbr;
 	} server;
 
 	const struct alphahttpd_filter **filters;
@@ -53,15 +92,72 @@ struct alphahttpd_conf {
 	ffuint max_keep_alive_reqs;
 
 	struct {
+		/** Initial size of the buffer for request headers */
 		ffuint buf_size;
+		/** The buffer grows up to this size (<=64K-1) for large request headers
+		 and while reading request body */
+		ffuint buf_max_size;
 		ffuint timeout_sec;
 	} receive;
 
 	struct {
 		ffstr www;
+
+		/** Index file names separated by comma, tried in order (e.g. "index.html,index.htm") */
 		ffstr index_filename;
 		ffuint file_buf_size;
 
+		/** Max. number of opened files cached by each worker (0: disabled) */
+		ffuint fd_cache_max;
+
+		/** Time (in seconds) during which cached file descriptors, file properties and in-memory responses are used
+		 without looking at the file system */
+		ffuint fd_cache_ttl_sec;
+
+		/** Max. total size of complete responses for small files kept in memory and shared by all workers (0: disabled) */
+		ffuint ocache_max_size;
+
+		/** Max. size of a file which response may be kept in memory (<= file_buf_size) */
+		ffuint ocache_file_max_size;
+
+		struct ahd_ocache *ocache;
+
+		/** Send files of this size or larger with sendfile() (0: disabled).
+		Note: sendfile() blocks the worker while the file data is read from disk.
+		Linux, FreeBSD; not used with server.io_uring. */
+		ffuint64 sendfile_min_size;
+
+		/** Send data of cached files of size [mmap_min_size..mmap_max_size]
+		 directly from the file mapping shared by all clients of the worker.
+		Note: the worker crashes with SIGBUS if the file is truncated while it's being sent.
+		UNIX; requires fd_cache_max. */
+		ffbyte mmap;
+		ffuint mmap_min_size, mmap_max_size;
+
+		/** Serve precompressed file variant ("file.br", "file.zst", "file.gz")
+		 if it exists and is accepted by client */
+		ffbyte precompressed;
+
+		/** Compress data of text files on-the-fly (zstd or gzip, if supported by build)
+		 when there's no precompressed variant.
+		The compression level is lowered when the worker is busy. */
+		ffbyte compress;
+		ffuint compress_min_size;
+
+		/** Max. size of a file which compressed data may be kept in memory (0: disabled; requires fd_cache_max) */
+		ffuint compress_cache_file_max_size;
+
+		/** Max. total size of compressed data kept in memory by each worker */
+		ffuint compress_cache_max_size;
+
+		/** Max. number of directory listings cached by each worker (0: disabled).
+		On Linux a cached listing is valid until the directory changes (inotify),
+		 otherwise - for fd_cache_ttl_sec. */
+		ffuint dir_cache_max;
+
+		/** Max. total size of directory listings cached by each worker */
+		ffuint dir_cache_max_size;
+
 		ffmap content_types_map;
 		char *content_types_data;
 	} fs;
@@ -100,6 +196,10 @@ FF_EXTERN void alphahttpd_filter_file_init(struct alphahttpd_conf *conf, ffstr c
 
 FF_EXTERN void alphahttpd_filter_file_uninit(struct alphahttpd_conf *conf);
 
+/** file: create in-memory cache shared by all workers (fs.ocache_max_size must be set)
+workers: max. number of workers that will use this configuration */
+FF_EXTERN int alphahttpd_filter_file_ocache_init(struct alphahttpd_conf *conf, ffuint workers);
+
 struct alphahttpd_virtdoc {
 	const char *path, *method;
 
@@ -107,6 +207,16 @@ struct alphahttpd_virtdoc {
 	The handler must set resp.content_length, response status, 'resp_done' flag.
 	If resp.content_length is not set, empty '200 OK' response is returned. */
 	void (*handler)(alphahttpd_client *c);
+
+	/** Called by virtspace filter for each part of the request body, before 'handler' (optional).
+	Requires 'reqbody' filter placed before 'virtspace'.
+	More data is read from the socket only after the function returns:
+	 a slow consumer slows down the client (TCP flow control), and the memory usage is bounded.
+	data: decoded body data;  valid only during the call
+	last: 1 if this is the last part
+	Return 0 to continue;
+	 !=0 to stop processing: the function sets response status (default: 400) */
+	int (*body)(alphahttpd_client *c, ffstr data, unsigned last);
 };
 
 /** Prepare the table of virtual documents.
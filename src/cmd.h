@@ -78,11 +78,21 @@ static int cmd_help()
 "-l, --listen ADDR   Listening IP and TCP port (def: 80)\n"
 "                      e.g. 8080 or 127.0.0.1:8080 or [::1]:8080\n"
 "-w, --www DIR       Web directory (def: www)\n"
+"    --index NAMES   Index file names, comma-separated (def: index.html)\n"
 "-t, --threads N     Worker threads (def: CPU#)\n"
 "-c, --cpumask N     CPU affinity bitmask, hex value (e.g. 15 for CPUs 0,2,4)\n"
 "-T, --kcall-threads N\n"
 "                    kcall worker threads (def: CPU#)\n"
 "-p, --polling       Active polling mode\n"
+"    --adaptive-polling USEC\n"
+"                    Busy-poll for USEC microseconds after activity, then sleep\n"
+"-u, --io-uring      Use io_uring for socket I/O (Linux)\n"
+"    --sendfile SIZE Use sendfile() for files of this size or larger\n"
+"    --mmap          Send files of 16KB..1MB from memory-mapped file (UNIX)\n"
+"    --precompressed Serve precompressed .br/.zst/.gz file variants\n"
+"    --compress      Compress text files on-the-fly (if built with zlib/zstd)\n"
+"    --mem-cache SIZE\n"
+"                    Max. size of in-memory cache for small files (def: 16MB; 0: disable)\n"
 "-D, --debug         Debug log level\n"
 "-h, --help          Show help\n"
 ;
@@ -93,10 +103,18 @@ static int cmd_help()
 static const ffcmdarg_arg ahd_cmd_args[] = {
 	{ 'l', "listen",	FFCMDARG_TSTR | FFCMDARG_FNOTEMPTY, (ffsize)cmd_listen },
 	{ 'w', "www",	FFCMDARG_TSTR | FFCMDARG_FNOTEMPTY, FF_OFF(struct ahd_conf, aconf.fs.www) },
+	{ 0, "index",	FFCMDARG_TSTR | FFCMDARG_FNOTEMPTY, FF_OFF(struct ahd_conf, aconf.fs.index_filename) },
 	{ 't', "threads",	FFCMDARG_TINT32, FF_OFF(struct ahd_conf, workers_n) },
 	{ 'T', "kcall-threads",	FFCMDARG_TINT32, FF_OFF(struct ahd_conf, kcall_workers) },
 	{ 'c', "cpumask",	FFCMDARG_TSTR, (ffsize)cmd_cpumask },
 	{ 'p', "polling",	FFCMDARG_TSWITCH, FF_OFF(struct ahd_conf, aconf.server.polling_mode) },
+	{ 0, "adaptive-polling",	FFCMDARG_TINT32, FF_OFF(struct ahd_conf, aconf.server.polling_usec) },
+	{ 'u', "io-uring",	FFCMDARG_TSWITCH, FF_OFF(struct ahd_conf, aconf.server.io_uring) },
+	{ 0, "sendfile",	FFCMDARG_TINT64, FF_OFF(struct ahd_conf, aconf.fs.sendfile_min_size) },
+	{ 0, "mmap",	FFCMDARG_TSWITCH, FF_OFF(struct ahd_conf, aconf.fs.mmap) },
+	{ 0, "precompressed",	FFCMDARG_TSWITCH, FF_OFF(struct ahd_conf, aconf.fs.precompressed) },
+	{ 0, "compress",	FFCMDARG_TSWITCH, FF_OFF(struct ahd_conf, aconf.fs.compress) },
+	{ 0, "mem-cache",	FFCMDARG_TINT32, FF_OFF(struct ahd_conf, aconf.fs.ocache_max_size) },
 	{ 'D', "debug",	FFCMDARG_TSWITCH, (ffsize)cmd_debug },
 	{ 'h', "help",	FFCMDARG_TSWITCH, (ffsize)cmd_help },
 	{}
@@ -107,6 +125,7 @@ void conf_destroy(struct ahd_conf *conf)
 	alphahttpd_filter_file_uninit(&conf->aconf);
 
 	ffstr_free(&conf->aconf.fs.www);
+	ffstr_free(&conf->aconf.fs.index_filename);
 	ffstr_free(&conf->root_dir);
 }
 
@@ -115,13 +134,15 @@ void conf_init(struct ahd_conf *conf)
 	struct alphahttpd_conf *ac = &conf->aconf;
 	alphahttpd_conf(NULL, ac);
 	ffstr_dupz(&ac->fs.www, "www");
+	ffstr_dupz(&ac->fs.index_filename, "index.html");
 
 	conf->fd_limit = ac->server.max_connections * 2;
 }
 
 int cmd_fin(struct ahd_conf *conf)
 {
-	if (!(conf->aconf.receive.buf_size > 16 && conf->aconf.response.buf_size > 16)) {
+	if (!(conf->aconf.receive.buf_size > 16 && conf->aconf.response.buf_size > 16
+		&& conf->aconf.receive.buf_size <= conf->aconf.receive.buf_max_size)) {
 		ffstderr_fmt("bad buffer sizes\n");
 		return -1;
 	}
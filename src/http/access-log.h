@@ -42,7 +42,7 @@ static int accesslog_process(alphahttpd_client *c)
 	if (cl_kcq_active(c))
 		cl_dbglog(c, "fffile_write: completed");
 
-	int r = fffile_write_async(ffstderr, c->acclog_buf.ptr, c->acclog_buf.len, cl_kcq(c));
+	int r = cl_file_write(c, ffstderr, c->acclog_buf.ptr, c->acclog_buf.len);
 	if (r < 0) {
 		if (fferr_last() == FFKCALL_EINPROGRESS) {
 			cl_dbglog(c, "fffile_write: in progress");
@@ -1,8 +1,41 @@
 /** alphahttpd: show directory contents
 2022, Simon Zolin */
 
+/* The directory entries along with their properties are read in batches of up to AI_BATCH entries
+ by a kcall thread, so the worker isn't blocked by a slow file system.
+If the first batch is the whole directory, the entries are sorted,
+ and the complete listing is passed at once and kept in the listing cache.
+Otherwise the listing is streamed in parts of bounded size while the entries are being read (in file system order):
+ the response length is unknown, so 'transfer' filter sends the data in chunks. */
+
 #include <http/client.h>
-#include <FFOS/dirscan.h>
+#include <http/dcache.h>
+#include <util/dirread.h>
+#include <ffbase/sort.h>
+
+#define AI_BATCH  4096
+#define AI_NAME_MAX  1024 // longer names are skipped
+
+struct ai_ent {
+	ffuint64 size;
+	ffint64 mtime_sec; // since 1970
+	ffsize name_off; // offset in autoindex.names
+	uint dir :1;
+	uint info :1; // size and mtime are valid
+};
+
+static const char ai_header_fmt[] =
+	"<html>\n"
+	"<head>\n"
+		"<meta charset=\"utf-8\">\n"
+		"<meta name=\"viewport\" content=\"width=device-width, initial-scale=1.0\">\n"
+		"<title>Index of %S</title>\n"
+	"</head>\n"
+	"<body>\n"
+		"<h1>Index of %S</h1>\n"
+		"<pre>\n"
+			"<a href=\"%S..\">..</a>\n";
+static const char ai_footer[] = "</pre></body></html>";
 
 static int autoindex_open(alphahttpd_client *c)
 {
@@ -15,69 +48,297 @@ static int autoindex_open(alphahttpd_client *c)
 
 void autoindex_close(alphahttpd_client *c)
 {
+	if (c->autoindex.dce != NULL) {
+		dcache_release(c->si->dcache, c->autoindex.dce);
+		c->autoindex.dce = NULL;
+	}
+	dirread_close(&c->autoindex.dr);
 	ffvec_free(&c->autoindex.path);
-	ffvec_free(&c->autoindex.buf);
+	ffvec_free(&c->autoindex.names);
+	ffvec_free(&c->autoindex.ents);
+	ffvec_free(&c->autoindex.html);
+	cl_buf_free(c, &c->autoindex.buf);
 }
 
-int autoindex_process(alphahttpd_client *c)
+/** Send the listing from cache
+Return 0 if found */
+static int ai_cache_get(alphahttpd_client *c)
+{
+	struct ahd_dcache *dc = c->si->dcache;
+	if (dc == NULL)
+		return -1;
+
+	fftime now = c->si->date(c->srv, NULL);
+	struct dcache_ent *e;
+	if (NULL == (e = dcache_find(dc, c->req.unescaped_path, now.sec)))
+		return -1;
+
+	cl_dbglog(c, "dcache: hit: %S", &c->req.unescaped_path);
+	c->autoindex.dce = e;
+	c->resp.content_length = e->html.len;
+	cl_resp_status_ok(c, HTTP_200_OK);
+	ffstr_setstr(&c->output, &e->html);
+	c->resp_done = 1;
+	return 0;
+}
+
+/** Keep the listing in cache;  the entry takes the ownership of the data */
+static void ai_cache_add(alphahttpd_client *c)
+{
+	struct ahd_dcache *dc = c->si->dcache;
+	if (dc == NULL)
+		return;
+
+	fftime now = c->si->date(c->srv, NULL);
+	ffstr html = FFSTR_INITSTR(&c->autoindex.html);
+	struct dcache_ent *e;
+	if (NULL == (e = dcache_add(dc, c->req.unescaped_path, c->autoindex.path.ptr, html, now.sec)))
+		return;
+
+	cl_dbglog(c, "dcache: added %S", &c->req.unescaped_path);
+	c->autoindex.dce = e;
+	ffvec_null(&c->autoindex.html);
+}
+
+/** Open the directory (once) and read the next batch of entries with their properties.
+Executed by a kcall thread: only the client's 'autoindex' data may be used here. */
+static void ai_scan(void *param)
+{
+	alphahttpd_client *c = param;
+	c->autoindex.err = 0;
+	c->autoindex.names.len = 0;
+	c->autoindex.ents.len = 0;
+	c->autoindex.ent_i = 0;
+	c->autoindex.more = 0;
+
+	if (!c->autoindex.opened) {
+		if (0 != dirread_open(&c->autoindex.dr, c->autoindex.path.ptr)) {
+			c->autoindex.err = fferr_last();
+			return;
+		}
+		c->autoindex.opened = 1;
+	}
+
+	while (c->autoindex.ents.len != AI_BATCH) {
+		const char *fn = dirread_next(&c->autoindex.dr);
+		if (fn == NULL) {
+			c->autoindex.err = fferr_last();
+			return;
+		}
+		ffsize n = ffsz_len(fn);
+		if (n > AI_NAME_MAX)
+			continue;
+
+		struct ai_ent *e;
+		if (NULL == (e = ffvec_zpushT(&c->autoindex.ents, struct ai_ent))) {
+			c->autoindex.err = ENOMEM;
+			return;
+		}
+		e->name_off = c->autoindex.names.len;
+		ffvec_add(&c->autoindex.names, fn, n + 1, 1);
+
+		fffileinfo fi;
+		if (0 == dirread_info(&c->autoindex.dr, fn, &fi)) {
+			e->info = 1;
+			e->dir = !!fffile_isdir(fffileinfo_attr(&fi));
+			e->size = fffileinfo_size(&fi);
+			e->mtime_sec = fffileinfo_mtime(&fi).sec;
+		}
+	}
+	c->autoindex.more = 1;
+}
+
+/** Read the next batch of entries
+Return 0 if done;  AHFILTER_ASYNC */
+static int ai_scan_start(alphahttpd_client *c)
 {
-	ffdirscan ds = {};
-	ffvec namebuf = {};
-
-	if (0 == ffvec_addfmt(&c->autoindex.path, "%S%S%Z"
-		, &c->conf->fs.www, &c->req.unescaped_path)) {
-		cl_errlog(c, "no memory");
-		cl_resp_status(c, HTTP_500_INTERNAL_SERVER_ERROR);
-		goto end;
+	if (0 != c->si->task_run(c->srv, c->kev, ai_scan, c))
+		return AHFILTER_ASYNC;
+	return 0;
+}
+
+/** Check the result of reading the batch
+Return 0 on success;  -1: the listing is incomplete */
+static int ai_scan_result(alphahttpd_client *c)
+{
+	if (c->autoindex.err != 0) {
+		fferr_set(c->autoindex.err);
+		cl_syswarnlog(c, "dirread_next: %s", c->autoindex.path.ptr);
+		return -1;
 	}
-	const char *path = c->autoindex.path.ptr;
-
-	if (0 != ffdirscan_open(&ds, path, 0)) {
-		cl_syswarnlog(c, "ffdirscan_open: %s", path);
-		int rc = HTTP_403_FORBIDDEN;
-		if (fferr_notexist(fferr_last()))
-			rc = HTTP_404_NOT_FOUND;
-		cl_resp_status(c, rc);
-		goto end;
+	return 0;
+}
+
+static void ai_ent_render(alphahttpd_client *c, ffvec *buf, const struct ai_ent *e)
+{
+	const ffstr *path = &c->req.unescaped_path;
+	const char *fn = (char*)c->autoindex.names.ptr + e->name_off;
+	const char *slash = (e->dir) ? "/" : "";
+
+	char info[64];
+	ffsize n = 0;
+	if (e->info) {
+		fftime t = {};
+		t.sec = e->mtime_sec + FFTIME_1970_SECONDS;
+		ffdatetime dt;
+		fftime_split1(&dt, &t);
+		n = fftime_tostr1(&dt, info, sizeof(info), FFTIME_DATE_YMD | FFTIME_HMS);
+		info[n++] = ' ';
+		info[n++] = ' ';
+		if (e->dir)
+			info[n++] = '-';
+		else
+			n += ffs_fromint(e->size, info + n, sizeof(info) - n, 0);
 	}
+	ffstr si = FFSTR_INITN(info, n);
+
+	ffvec_addfmt(buf, "<a href=\"%S%s%s\">%s%s</a>  %S\n"
+		, path, fn, slash, fn, slash, &si);
+}
+
+static int ai_ent_cmp(const void *a, const void *b, void *udata)
+{
+	const struct ai_ent *e1 = a, *e2 = b;
+	const char *names = udata;
+	return ffsz_cmp(names + e1->name_off, names + e2->name_off);
+}
 
-	ffvec_addfmt(&c->autoindex.buf,
-		"<html>\n"
-		"<head>\n"
-			"<meta charset=\"utf-8\">\n"
-			"<meta name=\"viewport\" content=\"width=device-width, initial-scale=1.0\">\n"
-			"<title>Index of %S</title>\n"
-		"</head>\n"
-		"<body>\n"
-			"<h1>Index of %S</h1>\n"
-			"<pre>\n"
-				"<a href=\"%S..\">..</a>\n"
-		, &c->req.unescaped_path, &c->req.unescaped_path, &c->req.unescaped_path);
-
-	ffvec_addstr(&namebuf, &c->req.unescaped_path);
-
-	for (;;) {
-		const char *fn = ffdirscan_next(&ds);
-		if (fn == NULL)
-			break;
-
-		namebuf.len = c->req.unescaped_path.len;
-		ffvec_add(&namebuf, fn, ffsz_len(fn)+1, 1);
-		ffvec_addfmt(&c->autoindex.buf, "<a href=\"%s\">%s</a>\n"
-			, namebuf.ptr, fn);
+/** Sort the entries and render the complete listing */
+static int ai_render_all(alphahttpd_client *c)
+{
+	struct ai_ent *ents = c->autoindex.ents.ptr;
+	ffsize n = c->autoindex.ents.len;
+	ffsort(ents, n, sizeof(struct ai_ent), ai_ent_cmp, c->autoindex.names.ptr);
+
+	const ffstr *path = &c->req.unescaped_path;
+	ffvec_addfmt(&c->autoindex.html, ai_header_fmt, path, path, path);
+	for (ffsize i = 0;  i != n;  i++) {
+		ai_ent_render(c, &c->autoindex.html, &ents[i]);
 	}
+	if (0 == ffvec_add(&c->autoindex.html, ai_footer, FFS_LEN(ai_footer), 1))
+		return -1;
 
-	ffvec_addfmt(&c->autoindex.buf, "</pre></body></html>");
+	ai_cache_add(c);
 
-	c->resp.content_length = c->autoindex.buf.len;
+	if (c->autoindex.dce != NULL)
+		ffstr_setstr(&c->output, &c->autoindex.dce->html);
+	else
+		ffstr_setstr(&c->output, &c->autoindex.html);
+	c->resp.content_length = c->output.len;
 	cl_resp_status_ok(c, HTTP_200_OK);
-	ffstr_setstr(&c->output, &c->autoindex.buf);
 	c->resp_done = 1;
+	return 0;
+}
+
+/** Render the next part of the listing into the buffer of bounded size */
+static int ai_stream(alphahttpd_client *c)
+{
+	ffvec *buf = &c->autoindex.buf;
+	// enough room for any entry or the footer: the buffer is never reallocated
+	ffsize reserve = c->req.unescaped_path.len + 2 * (AI_NAME_MAX + 1) + 128;
+
+	while (buf->cap - buf->len >= reserve) {
+		if (c->autoindex.ent_i == c->autoindex.ents.len) {
+			if (!c->autoindex.more) {
+				ffvec_add(buf, ai_footer, FFS_LEN(ai_footer), 1);
+				ffstr_setstr(&c->output, buf);
+				c->resp_done = 1;
+				return AHFILTER_DONE;
+			}
+
+			if (buf->len != 0)
+				break; // send the data rendered so far, then read more
+
+			c->autoindex.state = 3;
+			if (AHFILTER_ASYNC == ai_scan_start(c))
+				return AHFILTER_ASYNC;
+			c->autoindex.state = 2;
+			if (0 != ai_scan_result(c))
+				return AHFILTER_ERR; // close the connection: the client must not take the listing as complete
+			continue;
+		}
 
-end:
-	ffvec_free(&namebuf);
-	ffdirscan_close(&ds);
-	return AHFILTER_DONE;
+		const struct ai_ent *e = ffslice_itemT(&c->autoindex.ents, c->autoindex.ent_i, struct ai_ent);
+		ai_ent_render(c, buf, e);
+		c->autoindex.ent_i++;
+	}
+
+	ffstr_setstr(&c->output, buf);
+	return AHFILTER_FWD;
+}
+
+int autoindex_process(alphahttpd_client *c)
+{
+	switch (c->autoindex.state) {
+	case 0:
+		if (0 == ai_cache_get(c))
+			return AHFILTER_DONE;
+
+		if (0 == ffvec_addfmt(&c->autoindex.path, "%S%S%Z"
+			, &c->conf->fs.www, &c->req.unescaped_path)) {
+			cl_errlog(c, "no memory");
+			cl_resp_status(c, HTTP_500_INTERNAL_SERVER_ERROR);
+			return AHFILTER_DONE;
+		}
+
+		c->autoindex.state = 1;
+		if (AHFILTER_ASYNC == ai_scan_start(c))
+			return AHFILTER_ASYNC;
+		// fallthrough
+
+	case 1: {
+		// the first batch is read
+		if (!c->autoindex.opened) {
+			fferr_set(c->autoindex.err);
+			cl_syswarnlog(c, "dirread_open: %s", c->autoindex.path.ptr);
+			int rc = HTTP_403_FORBIDDEN;
+			if (fferr_notexist(c->autoindex.err))
+				rc = HTTP_404_NOT_FOUND;
+			cl_resp_status(c, rc);
+			return AHFILTER_DONE;
+		}
+		if (0 != ai_scan_result(c)) {
+			// don't send or cache a partial listing
+			cl_resp_status(c, HTTP_500_INTERNAL_SERVER_ERROR);
+			return AHFILTER_DONE;
+		}
+
+		if (!c->autoindex.more) {
+			if (0 != ai_render_all(c)) {
+				cl_errlog(c, "no memory");
+				cl_resp_status(c, HTTP_500_INTERNAL_SERVER_ERROR);
+			}
+			return AHFILTER_DONE;
+		}
+
+		// a large directory: stream the listing
+		const ffstr *path = &c->req.unescaped_path;
+		ffsize cap = c->conf->fs.file_buf_size + 3 * path->len + 2 * AI_NAME_MAX + 512;
+		if (NULL == cl_buf_alloc(c, &c->autoindex.buf, cap)) {
+			cl_errlog(c, "no memory");
+			cl_resp_status(c, HTTP_500_INTERNAL_SERVER_ERROR);
+			return AHFILTER_DONE;
+		}
+		ffvec_addfmt(&c->autoindex.buf, ai_header_fmt, path, path, path);
+		c->resp.content_length = (ffuint64)-1;
+		cl_resp_status_ok(c, HTTP_200_OK);
+		c->autoindex.state = 2;
+		return ai_stream(c);
+	}
+
+	case 2:
+		// the previous part has been sent
+		c->autoindex.buf.len = 0;
+		return ai_stream(c);
+
+	case 3:
+		// the next batch is read
+		c->autoindex.state = 2;
+		if (0 != ai_scan_result(c))
+			return AHFILTER_ERR;
+		return ai_stream(c);
+	}
+	return AHFILTER_ERR;
 }
 
 const struct alphahttpd_filter alphahttpd_filter_autoindex = {
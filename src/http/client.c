@@ -19,14 +19,10 @@ static void cl_init(alphahttpd_client *c)
 	c->resp.content_length = (ffuint64)-1;
 }
 
-/** Start processing the client */
-void cl_start(struct ahd_kev *kev, ffsock csock, const ffsockaddr *peer, uint conn_id, alphahttpd *srv, struct ahd_server *si)
+/** Start processing the client
+c: object from the worker's preallocated array */
+void cl_start(alphahttpd_client *c, struct ahd_kev *kev, ffsock csock, const ffsockaddr *peer, uint conn_id, alphahttpd *srv, struct ahd_server *si)
 {
-	alphahttpd_client *c = ffmem_alloc(sizeof(alphahttpd_client));
-	if (c == NULL) {
-		si->conf->log(si->conf->opaque, ALPHAHTTPD_LOG_ERR, NULL, "no memory");
-		return;
-	}
 	ffmem_zero_obj(c);
 	c->sk = csock;
 	c->srv = srv;
@@ -82,13 +78,22 @@ static void cl_mods_close(alphahttpd_client *c)
 
 void cl_destroy(alphahttpd_client *c)
 {
+	if (c->kev->task_pending
+		|| (c->conf->server.io_uring
+			&& 0 != c->si->io_cancel(c->srv, c->kev))) {
+		// the kernel or a kcall thread may still use the client data: finish after the operation completes
+		cl_dbglog(c, "waiting for pending operations");
+		c->kev->rhandler = (ahd_kev_func)cl_destroy;
+		c->kev->whandler = (ahd_kev_func)cl_destroy;
+		return;
+	}
+
 	cl_verblog(c, "closing client connection");
 	ffsock_close(c->sk);
 	ffkcall_cancel(&c->kev->kcall);
 
 	cl_mods_close(c);
 	sv_conn_fin(c->srv, c->kev);
-	ffmem_free(c);
 }
 
 static void cl_reset(alphahttpd_client *c)
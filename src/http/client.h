@@ -6,9 +6,11 @@
 #include <alphahttpd.h>
 #include <util/range.h>
 #include <util/http1.h>
+#include <util/http1-hdr.h>
 #include <util/http1-status.h>
 #include <FFOS/dir.h>
-#include <FFOS/timerqueue.h>
+#include <util/twheel.h>
+#include <util/dirread.h>
 #include <ffbase/time.h>
 #include <ffbase/vector.h>
 
@@ -16,6 +18,14 @@
 typedef unsigned int uint;
 #endif
 
+#if defined FF_LINUX || defined FF_BSD
+	#define AHD_HAVE_SENDFILE
+#endif
+
+#ifdef FF_UNIX
+	#define AHD_HAVE_MMAP
+#endif
+
 /** Client-context logger */
 
 #define cl_errlog(c, ...) \
@@ -50,6 +60,16 @@ do { \
 #endif
 
 
+/** State of an io_uring operation */
+struct ahd_urtask {
+	int result;
+	int fd; // socket:  waiting for readiness after EAGAIN
+	uint pending :1;
+	uint done :1;
+	uint cancel :1; // cancel request is submitted
+	uint poll :1; // waiting for socket readiness (POLL_ADD)
+};
+
 typedef void (*ahd_kev_func)(void *obj);
 struct ahd_kev {
 	ahd_kev_func rhandler, whandler;
@@ -62,19 +82,86 @@ struct ahd_kev {
 	void *obj;
 	struct ahd_kev *next_kev;
 	struct ffkcall kcall;
+	struct ahd_urtask urtask_r, urtask_w;
+	struct ahd_urtask urtask_f; // file operation
+	struct alphahttpd_task task; // blocking operation executed by a kcall thread
+	uint task_pending :1;
 };
 
-typedef fftimerqueue_node ahd_timer;
+typedef struct twheel_node ahd_timer;
+
+struct ahd_fcache;
+struct fcache_ent;
+struct ahd_dcache;
+struct dcache_ent;
+struct tinylfu;
+struct zcomp;
 
 /** Server runtime interface */
 struct ahd_server {
 	struct alphahttpd_conf *conf;
 	fftime (*date)(alphahttpd *srv, ffstr *dts);
 	int (*kq_attach)(alphahttpd *srv, ffsock sk, struct ahd_kev *kev, void *obj);
-	void (*timer)(alphahttpd *srv, ahd_timer *tmr, int interval_msec, fftimerqueue_func func, void *param);
+	void (*timer)(alphahttpd *srv, ahd_timer *tmr, int interval_msec, twheel_func func, void *param);
 	void (*cl_destroy)(alphahttpd_client *c);
+
+	/** Get buffer of at least 'size' bytes from the worker's pool */
+	void* (*buf_alloc)(alphahttpd *srv, ffvec *buf, ffsize size);
+
+	/** Return buffer to the worker's pool */
+	void (*buf_free)(alphahttpd *srv, ffvec *buf);
+
+	/** io_uring I/O: begin asynchronous operation or get the result of the completed one.
+	Return N of bytes transferred
+	 <0: error or FFSOCK_EINPROGRESS */
+	int (*recv)(alphahttpd *srv, struct ahd_kev *kev, ffsock sk, void *buf, ffsize cap);
+	int (*sendv)(alphahttpd *srv, struct ahd_kev *kev, ffsock sk, ffiovec *iov, uint iov_n);
+
+	/** Execute the blocking function on a kcall thread
+	Return 0: completed synchronously;
+	 1: in progress: kev->rhandler() is called on completion */
+	int (*task_run)(alphahttpd *srv, struct ahd_kev *kev, void (*func)(void *param), void *param);
+
+	/** Cancel all pending io_uring operations
+	Return 1 if an operation is still in progress:
+	 the client must not be freed until it completes */
+	int (*io_cancel)(alphahttpd *srv, struct ahd_kev *kev);
+
+	/** io_uring file I/O (NULL if not supported by kernel):
+	 begin asynchronous operation or get the result of the completed one.
+	Return <0: error or FFKCALL_EINPROGRESS */
+	fffd (*file_open)(alphahttpd *srv, struct ahd_kev *kev, const char *name, uint flags);
+	int (*file_info)(alphahttpd *srv, struct ahd_kev *kev, fffd f, void *statx, fffileinfo *fi);
+	ffssize (*file_read)(alphahttpd *srv, struct ahd_kev *kev, fffd f, int fixed, void *buf, ffsize cap, ffuint64 off);
+	ffssize (*file_write)(alphahttpd *srv, struct ahd_kev *kev, fffd f, const void *data, ffsize n);
+
+	/** Get a buffer registered for io_uring file I/O (NULL if there's none);  freed with buf_free() */
+	void* (*fixed_buf_alloc)(alphahttpd *srv, ffvec *buf, ffsize size);
+
+	/** Register file descriptor for io_uring file I/O (NULL if not supported)
+	Return index of the registered file;  -1 on error */
+	int (*file_register)(alphahttpd *srv, fffd f);
+	void (*file_unregister)(alphahttpd *srv, int fixed);
+
+	/** Per-worker cache of opened files (NULL if disabled) */
+	struct ahd_fcache *fcache;
+
+	/** Per-worker cache of directory listings (NULL if disabled) */
+	struct ahd_dcache *dcache;
+
+	/** Access frequencies of files seen by this worker;
+	 used by in-memory cache (conf->fs.ocache);  NULL if it's disabled */
+	struct tinylfu *ocache_freq;
+
+	/** Worker load (0..100%) during the last second; measured only with conf->fs.compress */
+	uint load;
+
+	/** N of file reads completed inline from page cache / N of reads passed to kcall or io_uring */
+	ffuint64 read_nowait_hits, read_nowait_misses;
 };
 
+#define AHD_HDR_OTHER_MAX  16
+
 /** Client (connection) context */
 struct alphahttpd_client {
 	struct ahd_kev *kev;
@@ -104,22 +191,52 @@ struct alphahttpd_client {
 	} recv;
 
 	struct {
-		range16 full, line, method, path, querystr, host, if_modified_since;
+		range16 full, line, method, url, path, querystr;
+		uint parsed; // N of bytes of the request line and complete header lines already processed
+		range16 hdr[HTTP_H_KNOWN]; // values of the known header fields (enum HTTP_H);  off=0: no field
+		struct {
+			range16 name, val;
+		} hdr_other[AHD_HDR_OTHER_MAX]; // the other header fields;  the rest are ignored
+		uint hdr_other_n;
 		ffstr unescaped_path;
+		ffsize unescaped_path_cap;
 		ffvec buf;
 	} req;
 
+	struct {
+		ffuint64 remain; // N of body bytes not yet read (Content-Length)
+		struct httpchunked chunked;
+		ffsize off; // offset of the next raw body data in req.buf
+		uint opened :1; // 'reqbody' filter is in use
+		uint complete :1; // the whole body has been read
+		uint continue_sent :1;
+	} reqbody;
+
 	struct {
 		const struct alphahttpd_virtdoc *vdoc;
 	} vspace;
 
 	struct {
-		ffvec buf;
+		ffvec buf; // "www/path/name"
+		ffsize dir_len; // length of "www/path/"
+		ffstr names; // index file names not yet tried
+		ffstr name; // the current index file name
+		uint async :1; // waiting for the file to open
 	} index;
 
 	struct {
-		ffvec path;
-		ffvec buf;
+		ffvec path; // "www/path/"
+		dirread dr;
+		ffvec names; // file names of the current batch, each is NUL-terminated
+		ffvec ents; // struct ai_ent[]: the current batch of entries
+		ffsize ent_i; // index of the next entry to render
+		ffvec html; // the complete listing
+		ffvec buf; // a part of the streamed listing
+		struct dcache_ent *dce;
+		int err; // error while reading the directory
+		uint state;
+		uint opened :1;
+		uint more :1; // there are more entries after the current batch
 	} autoindex;
 
 	struct {
@@ -127,12 +244,42 @@ struct alphahttpd_client {
 		ffvec buf;
 		fffileinfo info;
 		uint state;
+		uint read :1; // file position has changed
+		struct fcache_ent *fce;
+		char last_modified[32];
+		char etag[64];
+		char content_range[80];
+		ffuint64 off; // start of the requested range
+		ffuint64 remain; // N of bytes left to read
+		ffuint64 rpos; // file offset of the next read (for io_uring)
+		uint accept_enc; // enum HTTP_ENC
+		uint variant; // 1 + index of the precompressed variant being tried
+		uint variant_cached :1; // the variant is in file cache
+		uint name_len; // length of the original file name
+		uint ocache_hash;
+		uint ocache_add :1; // add the complete response to in-memory cache
+#ifdef FF_LINUX
+		ffuint64 statx[256 / 8]; // struct statx for io_uring
+#endif
 	} file;
 
+	struct {
+		struct zcomp *z;
+		ffvec buf;
+		ffstr in; // input data not yet processed
+		ffvec cache; // the whole compressed data to be kept in file cache
+		uint type; // enum ZCOMP_T; set by 'file' filter
+		int level;
+		uint fin :1; // no more input data
+		uint cache_add :1;
+	} compress;
+
 	ffstr acclog_buf;
 
 	struct {
 		ffuint64 cont_len;
+		ffvec buf;
+		uint chunked :1;
 	} transfer;
 
 	struct {
@@ -140,6 +287,9 @@ struct alphahttpd_client {
 		ffuint64 content_length;
 		ffstr msg, location, content_type;
 		ffstr last_modified;
+		ffstr etag;
+		ffstr content_range;
+		ffstr content_encoding;
 		ffvec buf;
 	} resp;
 
@@ -148,13 +298,27 @@ struct alphahttpd_client {
 		uint iov_n;
 		ahd_timer timer;
 		ffuint64 transferred;
+
+		// file data to send with sendfile(): [file_off..file_end)
+		fffd file;
+		ffuint64 file_off, file_end;
+
+		ffstr shared; // response data in shared memory; valid only during the current event loop iteration
+		ffvec buf;
 	} send;
 
 	uint chain_back :1;
 	uint req_method_head :1;
+	uint req_http11 :1;
+	uint req_body :1; // request has a body
+	uint req_body_chunked :1;
+	uint req_body_hdr_conflict :1; // Content-Length or Transfer-Encoding is repeated with a different value
 	uint resp_connection_keepalive :1;
 	uint resp_err :1;
 	uint resp_done :1;
+	uint resp_accept_ranges :1;
+	uint resp_vary_encoding :1;
+	uint resp_cached :1; // complete response is taken from in-memory cache
 	uint ka :1;
 
 	uint imod;
@@ -173,6 +337,38 @@ struct alphahttpd_client {
 #define cl_timer_stop(c, tmr) \
 	c->si->timer(c->srv, tmr, 0, NULL, NULL)
 
+/** Get buffer from the worker's pool */
+#define cl_buf_alloc(c, buf, size) \
+	c->si->buf_alloc(c->srv, buf, size)
+
+/** Return buffer to the worker's pool */
+#define cl_buf_free(c, buf) \
+	c->si->buf_free(c->srv, buf)
+
+/** Move the data to a new buffer from the worker's pool
+size: >= buf->len
+Return 0 on success */
+static inline int cl_buf_realloc(alphahttpd_client *c, ffvec *buf, ffsize size)
+{
+	ffvec nb = {};
+	if (NULL == cl_buf_alloc(c, &nb, size))
+		return -1;
+
+	ffmem_copy(nb.ptr, buf->ptr, buf->len);
+	nb.len = buf->len;
+	cl_buf_free(c, buf);
+	*buf = nb;
+	return 0;
+}
+
+/** Get the number of bytes the receive buffer may hold:
+ the buffer's capacity (the pool's size class) may exceed `receive.buf_max_size` */
+static inline ffsize cl_req_buf_cap(alphahttpd_client *c)
+{
+	ffsize max = ffmin(c->conf->receive.buf_max_size, RANGE16_MAX);
+	return ffmin(c->req.buf.cap, max);
+}
+
 /** Set error HTTP response status */
 static inline void cl_resp_status(alphahttpd_client *c, enum HTTP_STATUS status)
 {
@@ -195,6 +391,67 @@ static inline void cl_resp_status_ok(alphahttpd_client *c, enum HTTP_STATUS stat
 #define cl_kcq(c)  &c->kev->kcall
 #define cl_kcq_active(c)  (c->kev->kcall.op != 0)
 
+/** Receive data from client */
+static inline int cl_recv(alphahttpd_client *c, void *buf, ffsize cap)
+{
+	if (c->conf->server.io_uring)
+		return c->si->recv(c->srv, c->kev, c->sk, buf, cap);
+	return ffsock_recv_async(c->sk, buf, cap, cl_kev_r(c));
+}
+
+/** Send data to client */
+static inline int cl_sendv(alphahttpd_client *c, ffiovec *iov, uint iov_n)
+{
+	if (c->conf->server.io_uring)
+		return c->si->sendv(c->srv, c->kev, c->sk, iov, iov_n);
+	return ffsock_sendv_async(c->sk, iov, iov_n, cl_kev_w(c));
+}
+
+/** Get buffer for file data: a registered buffer is used for io_uring reads */
+static inline void* cl_file_buf_alloc(alphahttpd_client *c, ffvec *buf, ffsize size)
+{
+	if (c->si->fixed_buf_alloc != NULL
+		&& NULL != c->si->fixed_buf_alloc(c->srv, buf, size))
+		return buf->ptr;
+	return cl_buf_alloc(c, buf, size);
+}
+
+/** Open file asynchronously */
+static inline fffd cl_file_open(alphahttpd_client *c, const char *name, uint flags)
+{
+	if (c->si->file_open != NULL)
+		return c->si->file_open(c->srv, c->kev, name, flags);
+	return fffile_open_async(name, flags, cl_kcq(c));
+}
+
+/** Get file properties asynchronously */
+static inline int cl_file_info(alphahttpd_client *c, fffd f, fffileinfo *fi)
+{
+#ifdef FF_LINUX
+	if (c->si->file_info != NULL)
+		return c->si->file_info(c->srv, c->kev, f, c->file.statx, fi);
+#endif
+	return fffile_info_async(f, fi, cl_kcq(c));
+}
+
+/** Read file data asynchronously
+fixed: index of the registered file;  -1: not registered
+off: file offset for io_uring (kcall reads from the current file position) */
+static inline ffssize cl_file_read(alphahttpd_client *c, fffd f, int fixed, void *buf, ffsize cap, ffuint64 off)
+{
+	if (c->si->file_read != NULL)
+		return c->si->file_read(c->srv, c->kev, f, fixed, buf, cap, off);
+	return fffile_read_async(f, buf, cap, cl_kcq(c));
+}
+
+/** Write data to file asynchronously */
+static inline ffssize cl_file_write(alphahttpd_client *c, fffd f, const void *data, ffsize n)
+{
+	if (c->si->file_write != NULL)
+		return c->si->file_write(c->srv, c->kev, f, data, n);
+	return fffile_write_async(f, data, n, cl_kcq(c));
+}
+
 static inline int cl_async(alphahttpd_client *c)
 {
 	if (!c->kq_attached) {
@@ -207,6 +464,36 @@ static inline int cl_async(alphahttpd_client *c)
 	return 0;
 }
 
+/** Get the value of a known request header field
+id: enum HTTP_H
+Return empty string if there's no such field */
+static inline ffstr cl_req_hdr(alphahttpd_client *c, uint id)
+{
+	return range16_tostr(&c->req.hdr[id], c->req.buf.ptr);
+}
+
+/** Find request header field by name (case-insensitive)
+Return 0 if found */
+static inline int cl_req_hdr_find(alphahttpd_client *c, ffstr name, ffstr *val)
+{
+	int id = http_hdr_id(name);
+	if (id >= 0) {
+		if (c->req.hdr[id].off == 0)
+			return -1;
+		*val = cl_req_hdr(c, id);
+		return 0;
+	}
+
+	for (uint i = 0;  i != c->req.hdr_other_n;  i++) {
+		ffstr n = range16_tostr(&c->req.hdr_other[i].name, c->req.buf.ptr);
+		if (ffstr_ieq2(&n, &name)) {
+			*val = range16_tostr(&c->req.hdr_other[i].val, c->req.buf.ptr);
+			return 0;
+		}
+	}
+	return -1;
+}
+
 
 enum AHFILTER_R {
 	AHFILTER_DONE,
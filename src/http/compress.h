@@ -0,0 +1,113 @@
+/** alphahttpd: on-the-fly compression filter
+2023, Simon Zolin */
+
+/* 'file' filter decides whether the data should be compressed and sets compress.type.
+The length of compressed data is unknown, so 'transfer' filter sends it in chunks.
+When the whole compressed data of a small file is ready, it's kept in file cache. */
+
+#include <http/client.h>
+#include <http/fcache.h>
+#include <util/compress.h>
+
+static int zfilter_open(alphahttpd_client *c)
+{
+	if (c->compress.type == 0)
+		return AHFILTER_SKIP;
+
+	if (NULL == (c->compress.z = ffmem_new(struct zcomp))
+		|| 0 != zcomp_open(c->compress.z, c->compress.type, c->compress.level)) {
+		cl_errlog(c, "compression init");
+		ffmem_free(c->compress.z);
+		c->compress.z = NULL;
+		return AHFILTER_ERR;
+	}
+
+	if (NULL == cl_buf_alloc(c, &c->compress.buf, c->conf->fs.file_buf_size)) {
+		cl_errlog(c, "no memory");
+		return AHFILTER_ERR;
+	}
+
+	c->resp.content_length = (ffuint64)-1;
+	return AHFILTER_FWD;
+}
+
+static void zfilter_close(alphahttpd_client *c)
+{
+	if (c->compress.z != NULL) {
+		zcomp_close(c->compress.z);
+		ffmem_free(c->compress.z);
+		c->compress.z = NULL;
+	}
+	cl_buf_free(c, &c->compress.buf);
+	ffvec_free(&c->compress.cache);
+}
+
+/** Append compressed data for file cache */
+static void zfilter_cache_append(alphahttpd_client *c, ffstr data)
+{
+	if (c->compress.cache.len + data.len > c->conf->fs.compress_cache_file_max_size
+		|| data.len != ffvec_add(&c->compress.cache, data.ptr, data.len, 1)) {
+		c->compress.cache_add = 0;
+		ffvec_free(&c->compress.cache);
+	}
+}
+
+/** Keep the whole compressed data in file cache */
+static void zfilter_cache_store(alphahttpd_client *c)
+{
+	ffstr d = FFSTR_INITSTR(&c->compress.cache);
+	if (d.len == 0 || c->file.fce == NULL)
+		return;
+
+	if (0 == fcache_zdata_set(c->si->fcache, c->file.fce, c->compress.type - 1, d)) {
+		cl_dbglog(c, "compress: cached %L bytes", d.len);
+		ffvec_null(&c->compress.cache);
+	}
+}
+
+static int zfilter_process(alphahttpd_client *c)
+{
+	if (!c->chain_back) {
+		c->compress.in = c->input;
+		if (c->resp_done) {
+			// 'resp_done' is set again after all compressed data is passed further
+			c->compress.fin = 1;
+			c->resp_done = 0;
+		}
+	} else if (c->compress.in.len == 0 && !c->compress.fin) {
+		return AHFILTER_BACK;
+	}
+
+	ffstr out = FFSTR_INITN(c->compress.buf.ptr, 0);
+	int done;
+	for (;;) {
+		if (0 != zcomp_process(c->compress.z, &c->compress.in, c->compress.fin, &out, c->compress.buf.cap, &done)) {
+			cl_errlog(c, "compression error");
+			return AHFILTER_ERR;
+		}
+		if (done
+			|| out.len == c->compress.buf.cap
+			|| (c->compress.in.len == 0 && !c->compress.fin))
+			break;
+	}
+
+	if (c->compress.cache_add)
+		zfilter_cache_append(c, out);
+
+	ffstr_setstr(&c->output, &out);
+
+	if (done) {
+		if (c->compress.cache_add)
+			zfilter_cache_store(c);
+		c->resp_done = 1;
+		return AHFILTER_DONE;
+	}
+
+	if (out.len == 0)
+		return AHFILTER_BACK;
+	return AHFILTER_FWD;
+}
+
+const struct alphahttpd_filter alphahttpd_filter_compress = {
+	zfilter_open, zfilter_close, zfilter_process
+};
@@ -0,0 +1,288 @@
+/** alphahttpd: per-worker cache of directory listings
+2023, Simon Zolin */
+
+/*
+dcache_new dcache_free
+dcache_find dcache_add
+dcache_release
+*/
+
+/* An entry holds the rendered HTML listing of a directory.
+An entry is valid for `ttl_sec` seconds.
+On Linux each cached directory is also watched via inotify:
+ the entry is removed as soon as the directory contents change.
+The pending inotify events are read before each lookup, without involving the event loop.
+The watch is added after the directory has been read,
+ so a change made while reading is reflected only after the entry expires.
+Entries are ordered by last use (LRU): when the cache is full, the least recently used idle entries are freed.
+An entry may be used by several clients at once;
+ a stale entry is removed from the cache and freed after the last client releases it
+ (or when the cache is freed). */
+
+#pragma once
+#include <http/client.h>
+#include <util/lru.h>
+#include <ffbase/map.h>
+#include <ffbase/murmurhash3.h>
+#ifdef FF_LINUX
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+struct dcache_ent {
+	struct lru_item lru; // in ahd_dcache.lru or ahd_dcache.stale
+	uint hash;
+	uint users;
+	uint stale :1;
+	int wd; // inotify watch descriptor;  -1: none
+	ffint64 expire_sec;
+
+	ffstr html; // rendered listing
+
+	uint path_len;
+	char path[];
+};
+
+struct ahd_dcache {
+	ffmap map; // path -> struct dcache_ent*
+	struct lru_list lru;
+	struct lru_list stale; // removed entries still in use
+	uint n, max;
+	ffsize size, max_size; // total size of cached data
+	uint ttl_sec;
+	int ifd; // inotify descriptor;  -1: not supported
+};
+
+static int dcache_keyeq(void *opaque, const void *key, ffsize keylen, void *val)
+{
+	const struct dcache_ent *e = val;
+	return (e->path_len == keylen
+		&& !ffmem_cmp(e->path, key, keylen));
+}
+
+/**
+max: max. number of entries
+max_size: max. total size of cached data
+ttl_sec: entry lifetime */
+static struct ahd_dcache* dcache_new(uint max, ffsize max_size, uint ttl_sec)
+{
+	struct ahd_dcache *dc = ffmem_new(struct ahd_dcache);
+	if (dc == NULL)
+		return NULL;
+	ffmap_init(&dc->map, dcache_keyeq);
+	dc->max = max;
+	dc->max_size = max_size;
+	dc->ttl_sec = ttl_sec;
+	dc->ifd = -1;
+#ifdef FF_LINUX
+	dc->ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+	return dc;
+}
+
+static void dcache_ent_free(struct dcache_ent *e)
+{
+	ffstr_free(&e->html);
+	ffmem_free(e);
+}
+
+/** Stop watching the directory unless another entry (e.g. the same directory via symlink) uses the watch */
+static void dcache_unwatch(struct ahd_dcache *dc, struct dcache_ent *e)
+{
+#ifdef FF_LINUX
+	if (e->wd < 0)
+		return;
+	for (struct lru_item *it = dc->lru.first;  it != NULL;  it = it->next) {
+		const struct dcache_ent *e2 = FF_STRUCTPTR(struct dcache_ent, lru, it);
+		if (e2 != e && e2->wd == e->wd) {
+			e->wd = -1;
+			return;
+		}
+	}
+	inotify_rm_watch(dc->ifd, e->wd);
+	e->wd = -1;
+#endif
+}
+
+/** Remove entry from cache;  free it now if it's not used */
+static void dcache_rm(struct ahd_dcache *dc, struct dcache_ent *e)
+{
+	dcache_unwatch(dc, e);
+	ffmap_rm_hash(&dc->map, e->hash, e);
+	lru_unlink(&dc->lru, &e->lru);
+	dc->n--;
+	dc->size -= e->html.len;
+
+	if (e->users != 0) {
+		e->stale = 1;
+		lru_push(&dc->stale, &e->lru);
+		return;
+	}
+	dcache_ent_free(e);
+}
+
+static void dcache_list_free(struct lru_list *l)
+{
+	struct lru_item *it = l->first;
+	while (it != NULL) {
+		struct dcache_ent *e = FF_STRUCTPTR(struct dcache_ent, lru, it);
+		it = it->next;
+		dcache_ent_free(e);
+	}
+}
+
+static void dcache_free(struct ahd_dcache *dc)
+{
+	if (dc == NULL) return;
+
+	dcache_list_free(&dc->lru);
+	dcache_list_free(&dc->stale);
+	ffmap_free(&dc->map);
+#ifdef FF_LINUX
+	if (dc->ifd >= 0)
+		close(dc->ifd);
+#endif
+	ffmem_free(dc);
+}
+
+#ifdef FF_LINUX
+/** Remove the entries of the changed directory */
+static void dcache_invalidate(struct ahd_dcache *dc, int wd)
+{
+	struct lru_item *it = dc->lru.first;
+	while (it != NULL) {
+		struct dcache_ent *e = FF_STRUCTPTR(struct dcache_ent, lru, it);
+		it = it->next;
+		if (wd < 0 || e->wd == wd)
+			dcache_rm(dc, e);
+	}
+}
+
+/** Process pending inotify events */
+static void dcache_sync(struct ahd_dcache *dc)
+{
+	if (dc->ifd < 0 || dc->n == 0)
+		return;
+
+	union {
+		struct inotify_event ev;
+		char buf[4096];
+	} u;
+	for (;;) {
+		ffssize r = read(dc->ifd, u.buf, sizeof(u.buf));
+		if (r <= 0)
+			break;
+
+		for (ffssize i = 0;  i < r; ) {
+			const struct inotify_event *ev = (void*)(u.buf + i);
+			if (ev->mask & IN_Q_OVERFLOW)
+				dcache_invalidate(dc, -1); // events are lost
+			else if (!(ev->mask & IN_IGNORED))
+				dcache_invalidate(dc, ev->wd);
+			i += sizeof(struct inotify_event) + ev->len;
+		}
+	}
+}
+#endif
+
+/** Find a valid entry and mark it as used
+Return NULL if not found */
+static struct dcache_ent* dcache_find(struct ahd_dcache *dc, ffstr path, ffint64 now_sec)
+{
+#ifdef FF_LINUX
+	dcache_sync(dc);
+#endif
+
+	uint hash = murmurhash3(path.ptr, path.len, 0x12345678);
+	struct dcache_ent *e = ffmap_find_hash(&dc->map, hash, path.ptr, path.len, NULL);
+	if (e == NULL)
+		return NULL;
+
+	if (now_sec >= e->expire_sec) {
+		dcache_rm(dc, e);
+		return NULL;
+	}
+
+	lru_use(&dc->lru, &e->lru);
+	e->users++;
+	return e;
+}
+
+/** Free the least recently used idle entries until there's enough room */
+static int dcache_evict(struct ahd_dcache *dc, ffsize size)
+{
+	struct lru_item *it = dc->lru.last;
+	while (dc->n == dc->max
+		|| dc->size + size > dc->max_size) {
+		if (it == NULL)
+			return -1;
+		struct dcache_ent *e = FF_STRUCTPTR(struct dcache_ent, lru, it);
+		it = it->prev;
+		if (e->users == 0)
+			dcache_rm(dc, e);
+	}
+	return 0;
+}
+
+/** Add new entry and mark it as used
+path: request path (the key)
+dir: NUL-terminated file system path of the directory
+html: data allocated on heap;  the entry takes the ownership on success
+Return NULL if the entry can't be added */
+static struct dcache_ent* dcache_add(struct ahd_dcache *dc, ffstr path, const char *dir
+	, ffstr html, ffint64 now_sec)
+{
+	ffsize size = html.len;
+	uint hash = murmurhash3(path.ptr, path.len, 0x12345678);
+	if (size > dc->max_size
+		|| NULL != ffmap_find_hash(&dc->map, hash, path.ptr, path.len, NULL)
+		|| 0 != dcache_evict(dc, size))
+		return NULL;
+
+	struct dcache_ent *e = ffmem_alloc(sizeof(struct dcache_ent) + path.len);
+	if (e == NULL)
+		return NULL;
+	ffmem_zero_obj(e);
+	e->path_len = path.len;
+	ffmem_copy(e->path, path.ptr, path.len);
+	e->hash = hash;
+	e->wd = -1;
+	e->expire_sec = now_sec + dc->ttl_sec;
+
+#ifdef FF_LINUX
+	if (dc->ifd >= 0) {
+		e->wd = inotify_add_watch(dc->ifd, dir
+			, IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF
+			| IN_CLOSE_WRITE | IN_ATTRIB // the listing shows file size and modification time
+			| IN_ONLYDIR);
+		if (e->wd < 0) {
+			ffmem_free(e);
+			return NULL;
+		}
+	}
+#endif
+
+	if (0 != ffmap_add_hash(&dc->map, e->hash, e)) {
+		dcache_unwatch(dc, e);
+		ffmem_free(e);
+		return NULL;
+	}
+
+	e->html = html;
+	e->users = 1;
+	lru_push(&dc->lru, &e->lru);
+	dc->n++;
+	dc->size += size;
+	return e;
+}
+
+/** Stop using the entry */
+static void dcache_release(struct ahd_dcache *dc, struct dcache_ent *e)
+{
+	FF_ASSERT(e->users != 0);
+	e->users--;
+	if (e->stale && e->users == 0) {
+		lru_unlink(&dc->stale, &e->lru);
+		dcache_ent_free(e);
+	}
+}
@@ -16,6 +16,11 @@ static void aherr_close(alphahttpd_client *c)
 
 static int aherr_process(alphahttpd_client *c)
 {
+	if (c->resp.code == 304) {
+		c->resp_done = 1;
+		return AHFILTER_DONE;
+	}
+
 	ffstr_setz(&c->resp.content_type, "text/plain");
 	c->resp.content_length = c->resp.msg.len;
 	c->resp_done = 1;
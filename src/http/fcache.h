@@ -0,0 +1,274 @@
+/** alphahttpd: per-worker cache of opened files
+2023, Simon Zolin */
+
+/*
+fcache_new fcache_free
+fcache_find fcache_add
+fcache_release
+fcache_evict
+fcache_map
+fcache_zdata_set
+*/
+
+/* A cache entry holds file descriptor and file properties,
+ or it just remembers that the file doesn't exist (fd == FFFILE_NULL).
+An entry is valid for `ttl_sec` seconds after it was added.
+Entries are ordered by last use (LRU): when the cache is full, the least recently used idle entry is closed.
+An entry may be used by several clients at once;
+ a stale entry is removed from the cache and closed after the last client releases it
+ (or when the cache is freed).
+An entry may also hold the compressed file data:
+ when the total size of compressed data exceeds the limit, the data of the least recently used idle entries is freed. */
+
+#pragma once
+#include <http/client.h>
+#include <util/lru.h>
+#include <ffbase/map.h>
+#include <ffbase/murmurhash3.h>
+#ifdef AHD_HAVE_MMAP
+#include <sys/mman.h>
+#endif
+
+struct fcache_ent {
+	struct lru_item lru; // in ahd_fcache.lru or ahd_fcache.stale
+	uint hash;
+	uint users;
+	uint stale :1;
+	ffint64 expire_sec;
+
+	fffd fd;
+	fffileinfo info;
+	ffstr content_type;
+	char last_modified[32];
+	uint last_modified_len;
+	char etag[64];
+	uint etag_len;
+	void *map; // the whole file mapped to memory
+	ffsize map_size;
+	ffstr zdata[2]; // compressed file data: [ZCOMP_GZIP-1], [ZCOMP_ZSTD-1]
+	int fixed; // index of the file registered for io_uring;  -1: not registered
+
+	uint path_len;
+	char path[];
+};
+
+struct ahd_fcache {
+	ffmap map; // path -> struct fcache_ent*
+	struct lru_list lru;
+	struct lru_list stale; // removed entries still in use
+	uint n, max;
+	uint ttl_sec;
+	ffsize zsize, zmax; // total size of compressed data
+
+	alphahttpd *srv;
+	void (*file_unregister)(alphahttpd *srv, int fixed);
+};
+
+static int fcache_keyeq(void *opaque, const void *key, ffsize keylen, void *val)
+{
+	const struct fcache_ent *e = val;
+	return (e->path_len == keylen
+		&& !ffmem_cmp(e->path, key, keylen));
+}
+
+/**
+zmax: max. total size of compressed data
+file_unregister: called when an entry with the file registered for io_uring is closed */
+static struct ahd_fcache* fcache_new(uint max, uint ttl_sec, ffsize zmax
+	, void (*file_unregister)(alphahttpd *srv, int fixed), alphahttpd *srv)
+{
+	struct ahd_fcache *fc = ffmem_new(struct ahd_fcache);
+	if (fc == NULL)
+		return NULL;
+	ffmap_init(&fc->map, fcache_keyeq);
+	fc->max = max;
+	fc->ttl_sec = ttl_sec;
+	fc->zmax = zmax;
+	fc->file_unregister = file_unregister;
+	fc->srv = srv;
+	return fc;
+}
+
+static void fcache_zdata_free(struct ahd_fcache *fc, struct fcache_ent *e)
+{
+	for (uint i = 0;  i != FF_COUNT(e->zdata);  i++) {
+		fc->zsize -= e->zdata[i].len;
+		ffstr_free(&e->zdata[i]);
+	}
+}
+
+static void fcache_ent_free(struct ahd_fcache *fc, struct fcache_ent *e)
+{
+	fcache_zdata_free(fc, e);
+	if (e->fixed >= 0)
+		fc->file_unregister(fc->srv, e->fixed);
+#ifdef AHD_HAVE_MMAP
+	if (e->map != NULL)
+		munmap(e->map, e->map_size);
+#endif
+	if (e->fd != FFFILE_NULL)
+		fffile_close(e->fd);
+	ffmem_free(e);
+}
+
+/** Remove entry from cache;  close it now if it's not used */
+static void fcache_rm(struct ahd_fcache *fc, struct fcache_ent *e)
+{
+	ffmap_rm_hash(&fc->map, e->hash, e);
+	lru_unlink(&fc->lru, &e->lru);
+	fc->n--;
+
+	if (e->users != 0) {
+		e->stale = 1;
+		lru_push(&fc->stale, &e->lru);
+		return;
+	}
+	fcache_ent_free(fc, e);
+}
+
+static void fcache_list_free(struct ahd_fcache *fc, struct lru_list *l)
+{
+	struct lru_item *it = l->first;
+	while (it != NULL) {
+		struct fcache_ent *e = FF_STRUCTPTR(struct fcache_ent, lru, it);
+		it = it->next;
+		fcache_ent_free(fc, e);
+	}
+}
+
+static void fcache_free(struct ahd_fcache *fc)
+{
+	if (fc == NULL) return;
+
+	fcache_list_free(fc, &fc->lru);
+	fcache_list_free(fc, &fc->stale);
+	ffmap_free(&fc->map);
+	ffmem_free(fc);
+}
+
+/** Close the least recently used idle entries
+n: max. number of entries to close
+Return N of closed entries */
+static uint fcache_evict(struct ahd_fcache *fc, uint n)
+{
+	uint k = 0;
+	struct lru_item *it = fc->lru.last;
+	while (it != NULL && k != n) {
+		struct fcache_ent *e = FF_STRUCTPTR(struct fcache_ent, lru, it);
+		it = it->prev;
+		if (e->users == 0) {
+			fcache_rm(fc, e);
+			k++;
+		}
+	}
+	return k;
+}
+
+/** Find a valid entry and mark it as used
+Return NULL if not found */
+static struct fcache_ent* fcache_find(struct ahd_fcache *fc, ffstr path, ffint64 now_sec)
+{
+	uint hash = murmurhash3(path.ptr, path.len, 0x12345678);
+	struct fcache_ent *e = ffmap_find_hash(&fc->map, hash, path.ptr, path.len, NULL);
+	if (e == NULL)
+		return NULL;
+
+	if (now_sec >= e->expire_sec) {
+		fcache_rm(fc, e);
+		return NULL;
+	}
+
+	lru_use(&fc->lru, &e->lru);
+	e->users++;
+	return e;
+}
+
+/** Add new entry which takes the ownership of the file descriptor and mark it as used
+fd: FFFILE_NULL: the file doesn't exist
+Return NULL if the cache is full or the entry already exists */
+static struct fcache_ent* fcache_add(struct ahd_fcache *fc, ffstr path, fffd fd, const fffileinfo *fi, ffint64 now_sec)
+{
+	uint hash = murmurhash3(path.ptr, path.len, 0x12345678);
+	if (NULL != ffmap_find_hash(&fc->map, hash, path.ptr, path.len, NULL))
+		return NULL;
+
+	if (fc->n == fc->max
+		&& 0 == fcache_evict(fc, 1))
+		return NULL;
+
+	struct fcache_ent *e = ffmem_alloc(sizeof(struct fcache_ent) + path.len);
+	if (e == NULL)
+		return NULL;
+	ffmem_zero_obj(e);
+	e->path_len = path.len;
+	ffmem_copy(e->path, path.ptr, path.len);
+	e->hash = hash;
+	if (0 != ffmap_add_hash(&fc->map, e->hash, e)) {
+		ffmem_free(e);
+		return NULL;
+	}
+
+	e->fd = fd;
+	e->fixed = -1;
+	e->info = *fi;
+	e->expire_sec = now_sec + fc->ttl_sec;
+	e->users = 1;
+	lru_push(&fc->lru, &e->lru);
+	fc->n++;
+	return e;
+}
+
+/** Stop using the entry */
+static void fcache_release(struct ahd_fcache *fc, struct fcache_ent *e)
+{
+	FF_ASSERT(e->users != 0);
+	e->users--;
+	if (e->stale && e->users == 0) {
+		lru_unlink(&fc->stale, &e->lru);
+		fcache_ent_free(fc, e);
+	}
+}
+
+#ifdef AHD_HAVE_MMAP
+/** Map the whole file to memory (once per entry)
+Return NULL on error */
+static const void* fcache_map(struct fcache_ent *e)
+{
+	if (e->map == NULL) {
+		ffsize n = fffileinfo_size(&e->info);
+		void *p = mmap(NULL, n, PROT_READ, MAP_SHARED, e->fd, 0);
+		if (p == MAP_FAILED)
+			return NULL;
+		e->map = p;
+		e->map_size = n;
+	}
+	return e->map;
+}
+#endif
+
+/** Keep the compressed file data in the entry
+i: index in fcache_ent.zdata[]
+data: data allocated with ffmem_alloc();  the entry takes the ownership on success
+Return 0 on success */
+static int fcache_zdata_set(struct ahd_fcache *fc, struct fcache_ent *e, uint i, ffstr data)
+{
+	if (e->stale
+		|| e->zdata[i].len != 0
+		|| data.len > fc->zmax)
+		return -1;
+
+	// free compressed data of the least recently used idle entries
+	struct lru_item *it = fc->lru.last;
+	while (fc->zsize + data.len > fc->zmax) {
+		if (it == NULL)
+			return -1;
+		struct fcache_ent *victim = FF_STRUCTPTR(struct fcache_ent, lru, it);
+		if (victim->users == 0)
+			fcache_zdata_free(fc, victim);
+		it = it->prev;
+	}
+
+	e->zdata[i] = data;
+	fc->zsize += data.len;
+	return 0;
+}
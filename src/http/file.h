@@ -2,9 +2,15 @@
 2022, Simon Zolin */
 
 #include <http/client.h>
+#include <http/fcache.h>
+#include <http/ocache.h>
+#include <util/compress.h>
 #include <util/ltconf.h>
 #include <FFOS/kcall.h>
 #include <ffbase/map.h>
+#ifdef FF_LINUX
+#include <sys/uio.h>
+#endif
 
 static int file_open(alphahttpd_client *c)
 {
@@ -24,7 +30,7 @@ static int file_open(alphahttpd_client *c)
 		cl_warnlog(c, "too small file buffer");
 		return AHFILTER_ERR;
 	}
-	if (NULL == ffvec_alloc(&c->file.buf, c->conf->fs.file_buf_size, 1)) {
+	if (NULL == cl_file_buf_alloc(c, &c->file.buf, c->conf->fs.file_buf_size)) {
 		cl_errlog(c, "no memory");
 		cl_resp_status(c, HTTP_500_INTERNAL_SERVER_ERROR);
 		return AHFILTER_SKIP;
@@ -34,16 +40,32 @@ static int file_open(alphahttpd_client *c)
 	ffstr_add2(fn, -1, &c->req.unescaped_path);
 	fn->ptr[fn->len] = '\0';
 
+	if ((c->conf->fs.precompressed || c->conf->fs.compress)
+		&& c->req.hdr[HTTP_H_ACCEPT_ENCODING].len != 0) {
+		ffstr ae = cl_req_hdr(c, HTTP_H_ACCEPT_ENCODING);
+		c->file.accept_enc = http_accept_encoding(ae);
+	}
+
 	return AHFILTER_FWD;
 }
 
 static void file_close(alphahttpd_client *c)
 {
-	if (c->file.f != FFFILE_NULL) {
+	if (c->file.fce != NULL) {
+		if (c->file.read
+			&& 0 > fffile_seek(c->file.f, 0, FFFILE_SEEK_BEGIN)) {
+			cl_syswarnlog(c, "fffile_seek");
+			fcache_rm(c->si->fcache, c->file.fce);
+		}
+		fcache_release(c->si->fcache, c->file.fce);
+		c->file.fce = NULL;
+		c->file.f = FFFILE_NULL;
+
+	} else if (c->file.f != FFFILE_NULL) {
 		fffile_close(c->file.f);
 		c->file.f = FFFILE_NULL;
 	}
-	ffvec_free(&c->file.buf);
+	cl_buf_free(c, &c->file.buf);
 }
 
 static int handle_redirect(alphahttpd_client *c, const fffileinfo *fi)
@@ -54,7 +76,7 @@ static int handle_redirect(alphahttpd_client *c, const fffileinfo *fi)
 	cl_dbglog(c, "handle_redirect: %s", c->file.buf.ptr);
 	cl_resp_status(c, HTTP_301_MOVED_PERMANENTLY);
 
-	ffstr host = range16_tostr(&c->req.host, c->req.buf.ptr);
+	ffstr host = cl_req_hdr(c, HTTP_H_HOST);
 	ffstr path = range16_tostr(&c->req.path, c->req.buf.ptr);
 	// TODO some bad clients may set Host header value without specifying the non-standard port
 	c->file.buf.len = ffs_format_r0(c->file.buf.ptr, c->file.buf.cap, "http://%S%S/"
@@ -63,26 +85,58 @@ static int handle_redirect(alphahttpd_client *c, const fffileinfo *fi)
 	return -1;
 }
 
-static int mtime(alphahttpd_client *c, const fffileinfo *fi)
+/** Format Last-Modified value
+buf: at least 30 bytes */
+static uint lastmod_str(const fffileinfo *fi, char *buf, ffsize cap)
 {
 	fftime mt = fffileinfo_mtime(fi);
 	mt.sec += FFTIME_1970_SECONDS;
 	ffdatetime dt;
 	fftime_split1(&dt, &mt);
-	int r = FFS_LEN("Wed, dd Sep yyyy hh:mm:ss GMT")+1;
-	if (NULL == ffstr_alloc(&c->resp.last_modified, r)) {
-		cl_errlog(c, "no memory");
-		cl_resp_status(c, HTTP_500_INTERNAL_SERVER_ERROR);
-		return -1;
+	return fftime_tostr1(&dt, buf, cap, FFTIME_WDMY);
+}
+
+/** Format ETag value from file ID, size and modification time: "\"ID-SIZE-MTIME\"" */
+static uint etag_str(const fffileinfo *fi, char *buf, ffsize cap)
+{
+	fftime mt = fffileinfo_mtime(fi);
+	ffuint64 mt_msec = (ffuint64)mt.sec*1000 + mt.nsec/1000000;
+	return ffs_format_r0(buf, cap, "\"%xU-%xU-%xU\""
+		, (ffuint64)fffileinfo_id(fi), (ffuint64)fffileinfo_size(fi), mt_msec);
+}
+
+/** Return 1 if the client already has this version of the file (conditional request) */
+static int f_not_modified(alphahttpd_client *c, ffstr etag, ffstr last_modified)
+{
+	if (c->req.hdr[HTTP_H_IF_NONE_MATCH].len != 0) {
+		// If-Modified-Since is ignored
+		ffstr inm = cl_req_hdr(c, HTTP_H_IF_NONE_MATCH);
+		return http_etag_match(inm, etag);
+
+	} else if (c->req.hdr[HTTP_H_IF_MODIFIED_SINCE].len != 0) {
+		ffstr ims = cl_req_hdr(c, HTTP_H_IF_MODIFIED_SINCE);
+		return ffstr_eq2(&last_modified, &ims);
 	}
-	c->resp.last_modified.len = fftime_tostr1(&dt, c->resp.last_modified.ptr, r, FFTIME_WDMY);
+	return 0;
+}
 
-	if (c->req.if_modified_since.len != 0) {
-		ffstr ims = range16_tostr(&c->req.if_modified_since, c->req.buf.ptr);
-		if (ffstr_eq2(&c->resp.last_modified, &ims)) {
-			cl_resp_status(c, HTTP_304_NOT_MODIFIED);
-			return -1;
-		}
+/** Set Last-Modified and ETag; handle conditional request
+Return !=0 if the file isn't modified */
+static int mtime(alphahttpd_client *c)
+{
+	if (c->file.fce != NULL) {
+		ffstr_set(&c->resp.last_modified, c->file.fce->last_modified, c->file.fce->last_modified_len);
+		ffstr_set(&c->resp.etag, c->file.fce->etag, c->file.fce->etag_len);
+	} else {
+		uint n = lastmod_str(&c->file.info, c->file.last_modified, sizeof(c->file.last_modified));
+		ffstr_set(&c->resp.last_modified, c->file.last_modified, n);
+		n = etag_str(&c->file.info, c->file.etag, sizeof(c->file.etag));
+		ffstr_set(&c->resp.etag, c->file.etag, n);
+	}
+
+	if (f_not_modified(c, c->resp.etag, c->resp.last_modified)) {
+		cl_resp_status(c, HTTP_304_NOT_MODIFIED);
+		return -1;
 	}
 	return 0;
 }
@@ -137,9 +191,24 @@ void alphahttpd_filter_file_uninit(struct alphahttpd_conf *conf)
 
 	ffmap_free(&conf->fs.content_types_map);
 	ffmem_free(conf->fs.content_types_data);
+
+	ocache_free(conf->fs.ocache);
+	conf->fs.ocache = NULL;
+	conf->server.qsbr = NULL;
+}
+
+int alphahttpd_filter_file_ocache_init(struct alphahttpd_conf *conf, ffuint workers)
+{
+	if (conf->fs.ocache_max_size == 0)
+		return 0;
+
+	if (NULL == (conf->fs.ocache = ocache_new(conf->fs.ocache_max_size, workers)))
+		return -1;
+	conf->server.qsbr = &conf->fs.ocache->qsbr;
+	return 0;
 }
 
-static void content_type(alphahttpd_client *c)
+static ffstr content_type(alphahttpd_client *c)
 {
 	ffstr x;
 	int r = ffpath_splitname(c->file.buf.ptr, c->file.buf.len, NULL, &x);
@@ -153,12 +222,275 @@ static void content_type(alphahttpd_client *c)
 		goto unknown;
 
 	ffuint lo = (ffuint64)val;
-	ffstr v = range16_tostr((range16*)&lo, c->conf->fs.content_types_data);
-	ffstr_setstr(&c->resp.content_type, &v);
-	return;
+	return range16_tostr((range16*)&lo, c->conf->fs.content_types_data);
 
 unknown:
-	ffstr_setz(&c->resp.content_type, "application/octet-stream");
+	return FFSTR_Z("application/octet-stream");
+}
+
+/** Add the opened file to cache */
+static void f_cache_add(alphahttpd_client *c)
+{
+	if (c->si->fcache == NULL)
+		return;
+
+	ffstr fn = FFSTR_INITN(c->file.buf.ptr, c->file.buf.len);
+	fftime now = c->si->date(c->srv, NULL);
+	struct fcache_ent *e;
+	if (NULL == (e = fcache_add(c->si->fcache, fn, c->file.f, &c->file.info, now.sec)))
+		return;
+
+	e->content_type = content_type(c);
+	e->last_modified_len = lastmod_str(&e->info, e->last_modified, sizeof(e->last_modified));
+	e->etag_len = etag_str(&e->info, e->etag, sizeof(e->etag));
+	if (c->si->file_register != NULL)
+		e->fixed = c->si->file_register(c->srv, e->fd);
+	c->file.fce = e;
+}
+
+static int f_sendfile(alphahttpd_client *c);
+static int f_mmap(alphahttpd_client *c);
+
+/** Use the complete response from in-memory cache
+Return 0 if found */
+static int f_ocache_get(alphahttpd_client *c)
+{
+	struct ahd_ocache *oc = c->conf->fs.ocache;
+	if (oc == NULL
+		|| !c->resp_connection_keepalive // cached response header contains "Connection: keep-alive"
+		|| c->req.hdr[HTTP_H_IF_MODIFIED_SINCE].len != 0
+		|| c->req.hdr[HTTP_H_IF_NONE_MATCH].len != 0
+		|| c->req.hdr[HTTP_H_RANGE].len != 0
+		|| c->file.accept_enc != 0) // only uncompressed responses are cached
+		return -1;
+
+	c->file.ocache_hash = ocache_hash(c->req.unescaped_path);
+	tinylfu_add(c->si->ocache_freq, c->file.ocache_hash);
+
+	fftime now = c->si->date(c->srv, NULL);
+	const struct ocache_obj *o;
+	if (NULL == (o = ocache_find(oc, c->req.unescaped_path, c->file.ocache_hash, now.sec))) {
+		c->file.ocache_add = 1;
+		return -1;
+	}
+
+	cl_dbglog(c, "ocache: hit: %S", &c->req.unescaped_path);
+	c->resp_cached = 1;
+	cl_resp_status_ok(c, HTTP_200_OK);
+	c->resp.content_length = o->data_len - o->hdr_len;
+	ffstr_set(&c->send.shared, o->data, (c->req_method_head) ? o->hdr_len : o->data_len);
+	ffiovec_set(&c->send.iov[0], c->send.shared.ptr, c->send.shared.len);
+	c->send.iov_n = 1;
+	c->resp_done = 1;
+	return 0;
+}
+
+/** Add the complete response (already sent to client) to in-memory cache */
+static void f_ocache_add(alphahttpd_client *c)
+{
+	if (!c->resp_connection_keepalive)
+		return;
+
+	ffstr hdr = FFSTR_INITSTR(&c->resp.buf), body = FFSTR_INITSTR(&c->file.buf);
+	fftime now = c->si->date(c->srv, NULL);
+	if (0 == ocache_add(c->conf->fs.ocache, c->req.unescaped_path, c->file.ocache_hash, hdr, body
+		, now.sec + c->conf->fs.fd_cache_ttl_sec, c->si->ocache_freq))
+		cl_dbglog(c, "ocache: added %S", &c->req.unescaped_path);
+}
+
+/** Use the file from cache
+Return 0 on success;  -1: the entry is released */
+static int f_cache_use(alphahttpd_client *c, struct fcache_ent *e)
+{
+	struct ahd_fcache *fc = c->si->fcache;
+	c->file.fce = e;
+	c->file.f = e->fd;
+	c->file.info = e->info;
+	c->resp.content_length = fffileinfo_size(&e->info);
+
+	ffstr etag = FFSTR_INITN(e->etag, e->etag_len)
+		, lastmod = FFSTR_INITN(e->last_modified, e->last_modified_len);
+	if (e->users != 1
+		&& !c->req_method_head
+		&& !f_not_modified(c, etag, lastmod) // 304 response has no body
+		&& !f_sendfile(c)
+		&& !f_mmap(c)) {
+		// another client reads this file: we can't share the file position
+		fcache_release(fc, e);
+		c->file.fce = NULL;
+		c->file.f = FFFILE_NULL;
+		return -1;
+	}
+
+	cl_dbglog(c, "fcache: hit: %s", c->file.buf.ptr);
+	return 0;
+}
+
+/** Get file descriptor and file properties from cache
+Return 0 if found */
+static int f_cache_get(alphahttpd_client *c)
+{
+	struct ahd_fcache *fc = c->si->fcache;
+	if (fc == NULL)
+		return -1;
+
+	ffstr fn = FFSTR_INITN(c->file.buf.ptr, c->file.buf.len);
+	fftime now = c->si->date(c->srv, NULL);
+	struct fcache_ent *e;
+	if (NULL == (e = fcache_find(fc, fn, now.sec)))
+		return -1;
+
+	if (e->fd == FFFILE_NULL) {
+		// the file didn't exist: check again
+		fcache_release(fc, e);
+		fcache_rm(fc, e);
+		return -1;
+	}
+
+	return f_cache_use(c, e);
+}
+
+/** Get the file variant from cache
+Return 0: found;  1: the file doesn't exist;  -1: must be opened */
+static int f_variant_cache_get(alphahttpd_client *c)
+{
+	struct ahd_fcache *fc = c->si->fcache;
+	if (fc == NULL)
+		return -1;
+
+	ffstr fn = FFSTR_INITN(c->file.buf.ptr, c->file.buf.len);
+	fftime now = c->si->date(c->srv, NULL);
+	struct fcache_ent *e;
+	if (NULL == (e = fcache_find(fc, fn, now.sec)))
+		return -1;
+
+	c->file.variant_cached = 1;
+	if (e->fd == FFFILE_NULL) {
+		fcache_release(fc, e);
+		return 1;
+	}
+	return f_cache_use(c, e);
+}
+
+/** Remember that the file variant doesn't exist */
+static void f_variant_notexist(alphahttpd_client *c)
+{
+	struct ahd_fcache *fc = c->si->fcache;
+	if (fc == NULL || c->file.variant_cached)
+		return;
+
+	ffstr fn = FFSTR_INITN(c->file.buf.ptr, c->file.buf.len);
+	fftime now = c->si->date(c->srv, NULL);
+	fffileinfo fi = {};
+	struct fcache_ent *e;
+	if (NULL != (e = fcache_add(fc, fn, FFFILE_NULL, &fi, now.sec)))
+		fcache_release(fc, e);
+}
+
+enum F_STATE {
+	F_LOOKUP, // find the response in memory cache
+	F_VARIANT, // find the next precompressed variant
+	F_VARIANT_OPEN,
+	F_VARIANT_INFO,
+	F_OPEN,
+	F_INFO,
+	F_DATA, // read file data
+	F_OCACHE_ADD, // the whole file has been read and sent
+};
+
+/** Find precompressed file variant accepted by client, e.g. "file.js.br" for "file.js".
+The variants are opened asynchronously;  the results are cached.
+Return AHFILTER_FWD if the variant is opened;  AHFILTER_SKIP: no variant;  AHFILTER_ASYNC */
+static int f_variant(alphahttpd_client *c)
+{
+	static const struct {
+		uint enc;
+		char ext[5], name[5];
+	} variants[] = {
+		{ HTTP_ENC_BR, ".br", "br" },
+		{ HTTP_ENC_ZSTD, ".zst", "zstd" },
+		{ HTTP_ENC_GZIP, ".gz", "gzip" },
+	};
+
+	ffstr *fn = (ffstr*)&c->file.buf;
+	if (c->file.variant == 0) {
+		if (!c->conf->fs.precompressed || c->file.accept_enc == 0
+			|| fn->len + 5 > c->file.buf.cap)
+			return AHFILTER_SKIP;
+		c->file.name_len = fn->len;
+		// a variant is served with the content type of the original file
+		c->resp.content_type = content_type(c);
+	}
+
+	for (;;) {
+		switch (c->file.state) {
+		case F_VARIANT: {
+			fn->len = c->file.name_len;
+			fn->ptr[fn->len] = '\0';
+			uint i = c->file.variant;
+			while (i != FF_COUNT(variants) && !(c->file.accept_enc & variants[i].enc)) {
+				i++;
+			}
+			if (i == FF_COUNT(variants))
+				return AHFILTER_SKIP;
+			c->file.variant = i + 1;
+
+			ffstr_add(fn, -1, variants[i].ext, ffsz_len(variants[i].ext));
+			fn->ptr[fn->len] = '\0';
+			c->file.variant_cached = 0;
+			int r = f_variant_cache_get(c);
+			if (r == 0)
+				goto done;
+			else if (r > 0)
+				continue;
+			c->file.state = F_VARIANT_OPEN;
+		}
+			// fallthrough
+
+		case F_VARIANT_OPEN:
+			if (FFFILE_NULL == (c->file.f = cl_file_open(c, fn->ptr, FFFILE_READONLY | FFFILE_NOATIME))) {
+				if (fferr_last() == FFKCALL_EINPROGRESS) {
+					cl_dbglog(c, "fffile_open: %s: in progress", fn->ptr);
+					return AHFILTER_ASYNC;
+				}
+				if (fferr_notexist(fferr_last()))
+					f_variant_notexist(c);
+				else
+					cl_syswarnlog(c, "fffile_open: %s", fn->ptr);
+				c->file.state = F_VARIANT;
+				continue;
+			}
+			c->file.state = F_VARIANT_INFO;
+			// fallthrough
+
+		case F_VARIANT_INFO:
+			if (0 != cl_file_info(c, c->file.f, &c->file.info)) {
+				if (fferr_last() == FFKCALL_EINPROGRESS) {
+					cl_dbglog(c, "fffile_info: in progress");
+					return AHFILTER_ASYNC;
+				}
+				cl_syswarnlog(c, "fffile_info: %s", fn->ptr);
+				goto next;
+			}
+			if (fffile_isdir(fffileinfo_attr(&c->file.info)))
+				goto next;
+
+			if (!c->file.variant_cached)
+				f_cache_add(c);
+			goto done;
+
+		next:
+			fffile_close(c->file.f);
+			c->file.f = FFFILE_NULL;
+			c->file.state = F_VARIANT;
+			continue;
+		}
+	}
+
+done:
+	cl_dbglog(c, "serving %s", fn->ptr);
+	ffstr_setz(&c->resp.content_encoding, variants[c->file.variant - 1].name);
+	return AHFILTER_FWD;
 }
 
 static int f_open(alphahttpd_client *c)
@@ -167,7 +499,7 @@ static int f_open(alphahttpd_client *c)
 	if (cl_kcq_active(c))
 		cl_dbglog(c, "fffile_open: completed");
 
-	if (FFFILE_NULL == (c->file.f = fffile_open_async(fname, FFFILE_READONLY | FFFILE_NOATIME, cl_kcq(c)))) {
+	if (FFFILE_NULL == (c->file.f = cl_file_open(c, fname, FFFILE_READONLY | FFFILE_NOATIME))) {
 		if (fferr_notexist(fferr_last())) {
 			cl_dbglog(c, "fffile_open: %s: not found", fname);
 			cl_resp_status(c, HTTP_404_NOT_FOUND);
@@ -175,6 +507,11 @@ static int f_open(alphahttpd_client *c)
 		} else if (fferr_last() == FFKCALL_EINPROGRESS) {
 			cl_dbglog(c, "fffile_open: %s: in progress", fname);
 			return AHFILTER_ASYNC;
+		} else if (fferr_fdlimit(fferr_last())
+			&& c->si->fcache != NULL
+			&& 0 != fcache_evict(c->si->fcache, 16)) {
+			cl_dbglog(c, "fcache: closed idle files");
+			return f_open(c);
 		}
 		cl_syswarnlog(c, "fffile_open: %s", fname);
 		cl_resp_status(c, HTTP_500_INTERNAL_SERVER_ERROR);
@@ -189,7 +526,7 @@ static int f_info(alphahttpd_client *c)
 	if (cl_kcq_active(c))
 		cl_dbglog(c, "fffile_info: completed");
 
-	if (0 != fffile_info_async(c->file.f, &c->file.info, cl_kcq(c))) {
+	if (0 != cl_file_info(c, c->file.f, &c->file.info)) {
 		if (fferr_last() == FFKCALL_EINPROGRESS) {
 			cl_dbglog(c, "fffile_info: in progress");
 			return AHFILTER_ASYNC;
@@ -201,40 +538,362 @@ static int f_info(alphahttpd_client *c)
 
 	if (0 != handle_redirect(c, &c->file.info))
 		return AHFILTER_DONE;
-	if (0 != mtime(c, &c->file.info))
+
+	f_cache_add(c);
+	return AHFILTER_FWD;
+}
+
+/** Return 1 if the file data should be sent with sendfile() */
+static int f_sendfile(alphahttpd_client *c)
+{
+#ifdef AHD_HAVE_SENDFILE
+	return (c->conf->fs.sendfile_min_size != 0
+		&& c->resp.content_length >= c->conf->fs.sendfile_min_size
+		&& !c->conf->server.io_uring);
+#else
+	return 0;
+#endif
+}
+
+/** Return 1 if the file data should be sent from the file mapping */
+static int f_mmap(alphahttpd_client *c)
+{
+#ifdef AHD_HAVE_MMAP
+	ffuint64 size = fffileinfo_size(&c->file.info);
+	return (c->conf->fs.mmap
+		&& size != 0
+		&& size >= c->conf->fs.mmap_min_size
+		&& size <= c->conf->fs.mmap_max_size);
+#else
+	return 0;
+#endif
+}
+
+/** Handle byte range request
+Return 0: continue processing (content_length is set to the range size or the whole file size)
+ !=0: range is not satisfiable */
+static int f_range(alphahttpd_client *c)
+{
+	if (c->req.hdr[HTTP_H_RANGE].len == 0)
+		return 0;
+
+	if (c->req.hdr[HTTP_H_IF_RANGE].len != 0) {
+		ffstr ir = cl_req_hdr(c, HTTP_H_IF_RANGE);
+		if (!(ffstr_eq2(&ir, &c->resp.etag)
+			|| ffstr_eq2(&ir, &c->resp.last_modified)))
+			return 0; // the file has changed: send the whole content
+	}
+
+	ffstr val = cl_req_hdr(c, HTTP_H_RANGE);
+	ffuint64 size = c->resp.content_length, off, n;
+	int r = http_range_parse(val, size, &off, &n);
+	if (r < 0)
+		return 0;
+
+	if (r > 0) {
+		r = ffs_format_r0(c->file.content_range, sizeof(c->file.content_range), "bytes */%U", size);
+		ffstr_set(&c->resp.content_range, c->file.content_range, r);
+		cl_resp_status(c, HTTP_416_REQUESTED_RANGE_NOT_SATISFIABLE);
+		return -1;
+	}
+
+	r = ffs_format_r0(c->file.content_range, sizeof(c->file.content_range), "bytes %U-%U/%U"
+		, off, off + n - 1, size);
+	ffstr_set(&c->resp.content_range, c->file.content_range, r);
+	cl_dbglog(c, "range: %S", &c->resp.content_range);
+	c->file.off = off;
+	c->resp.content_length = n;
+	cl_resp_status_ok(c, HTTP_206_PARTIAL);
+	return 0;
+}
+
+/** Return 1 if data of this content type should be compressed */
+static int ct_compressible(ffstr ct)
+{
+	static const char types[][24] = {
+		"application/javascript",
+		"application/json",
+		"application/xml",
+		"image/svg+xml",
+	};
+	if (ffstr_matchz(&ct, "text/"))
+		return 1;
+	for (uint i = 0;  i != FF_COUNT(types);  i++) {
+		if (ffstr_eqz(&ct, types[i]))
+			return 1;
+	}
+	return 0;
+}
+
+/** Get compression level depending on the worker load
+Return 0 if the worker is too busy to compress data */
+static int f_compress_level(alphahttpd_client *c, uint type)
+{
+	uint load = c->si->load;
+	if (load >= 90)
+		return 0;
+	if (load >= 60)
+		return 1;
+	return (type == ZCOMP_GZIP) ? 6 : 3;
+}
+
+/** Convert ETag to a weak one: the compressed data isn't byte-identical to the file */
+static void f_etag_weak(alphahttpd_client *c)
+{
+	ffsize n = c->resp.etag.len;
+	FF_ASSERT(n + 2 <= sizeof(c->file.etag));
+	ffmem_move(c->file.etag + 2, c->resp.etag.ptr, n);
+	c->file.etag[0] = 'W';
+	c->file.etag[1] = '/';
+	ffstr_set(&c->resp.etag, c->file.etag, n + 2);
+}
+
+/** Get the compression type accepted by client for the file data
+Return enum ZCOMP_T;  0: the data shouldn't be compressed */
+static uint f_compress_type(alphahttpd_client *c, ffstr ct, ffuint64 size)
+{
+	uint type = 0;
+	if ((c->file.accept_enc & HTTP_ENC_ZSTD) && zcomp_supported(ZCOMP_ZSTD))
+		type = ZCOMP_ZSTD;
+	else if ((c->file.accept_enc & HTTP_ENC_GZIP) && zcomp_supported(ZCOMP_GZIP))
+		type = ZCOMP_GZIP;
+
+	if (!c->conf->fs.compress
+		|| type == 0
+		|| c->resp.content_encoding.len != 0 // precompressed variant
+		|| size < c->conf->fs.compress_min_size
+		|| !ct_compressible(ct))
+		return 0;
+	return type;
+}
+
+/** Set the ETag of 304 response:
+ it must be the same as the ETag of 200 response, which is weak for the compressed data */
+static void f_etag_304(alphahttpd_client *c)
+{
+	ffstr ct = (c->file.fce != NULL) ? c->file.fce->content_type : content_type(c);
+	uint type = f_compress_type(c, ct, fffileinfo_size(&c->file.info));
+	if (type == 0)
+		return;
+
+	const struct fcache_ent *e = c->file.fce;
+	if ((e != NULL && e->zdata[type - 1].len != 0)
+		|| f_compress_level(c, type) != 0)
+		f_etag_weak(c);
+}
+
+/** Decide whether to compress file data on-the-fly ('compress' filter)
+Return 0: send data as is
+ 1: compress data
+ 2: compressed data is taken from file cache */
+static int f_compress(alphahttpd_client *c)
+{
+	static const char names[][5] = { "gzip", "zstd" };
+	uint type;
+	if (c->resp.code != 200
+		|| 0 == (type = f_compress_type(c, c->resp.content_type, c->resp.content_length)))
+		return 0;
+
+	struct fcache_ent *e = c->file.fce;
+	if (e != NULL && e->zdata[type - 1].len != 0) {
+		cl_dbglog(c, "compress: cache hit: %s", names[type - 1]);
+		c->output = e->zdata[type - 1];
+		c->resp.content_length = c->output.len;
+		ffstr_setz(&c->resp.content_encoding, names[type - 1]);
+		f_etag_weak(c);
+		return 2;
+	}
+
+	if (e != NULL && e->users != 1 && !f_mmap(c)
+		&& !c->req_method_head)
+		return 0; // the file position is shared with another client
+
+	int level = f_compress_level(c, type);
+	if (level == 0)
+		return 0;
+
+	c->compress.type = type;
+	c->compress.level = level;
+	c->compress.cache_add = (e != NULL
+		&& c->conf->fs.compress_cache_max_size != 0
+		&& c->resp.content_length <= c->conf->fs.compress_cache_file_max_size);
+	ffstr_setz(&c->resp.content_encoding, names[type - 1]);
+	f_etag_weak(c);
+	return 1;
+}
+
+/** Prepare response for the opened file */
+static int f_ready(alphahttpd_client *c)
+{
+	if (0 != mtime(c)) {
+		f_etag_304(c);
 		return AHFILTER_DONE;
-	content_type(c);
+	}
+
+	if (c->resp.content_encoding.len == 0) {
+		// for a precompressed variant the content type of the original file is already set
+		if (c->file.fce != NULL)
+			ffstr_setstr(&c->resp.content_type, &c->file.fce->content_type);
+		else
+			c->resp.content_type = content_type(c);
+	}
+	c->resp_vary_encoding = (c->conf->fs.precompressed || c->conf->fs.compress);
 
 	c->resp.content_length = fffileinfo_size(&c->file.info);
 	cl_resp_status_ok(c, HTTP_200_OK);
+	c->resp_accept_ranges = 1;
+	if (0 != f_range(c))
+		return AHFILTER_DONE;
+
+	int z = f_compress(c);
 
 	if (c->req_method_head) {
+		// the same header fields as for GET, but no data
+		if (z == 1) {
+			c->compress.type = 0;
+			c->resp.content_length = (ffuint64)-1;
+		}
+		ffstr_null(&c->output);
 		c->resp_done = 1;
 		return AHFILTER_DONE;
 	}
 
+	if (z == 2) {
+		c->resp_done = 1;
+		return AHFILTER_DONE;
+	}
+
+	if (z == 0 && f_sendfile(c)) {
+		// 'send' filter transfers the file data after the response header
+		c->send.file = c->file.f;
+		c->send.file_off = c->file.off;
+		c->send.file_end = c->file.off + c->resp.content_length;
+		c->resp_done = 1;
+		return AHFILTER_DONE;
+	}
+
+#ifdef AHD_HAVE_MMAP
+	if (c->file.fce != NULL && f_mmap(c)) {
+		// pass the whole file data at once: 'response' filter sends it along with the header
+		//  or 'compress' filter compresses it
+		const void *d;
+		if (NULL == (d = fcache_map(c->file.fce))) {
+			cl_syswarnlog(c, "mmap: %s", c->file.buf.ptr);
+			return AHFILTER_ERR;
+		}
+		ffstr_set(&c->output, (char*)d + c->file.off, c->resp.content_length);
+		c->resp_done = 1;
+		return AHFILTER_DONE;
+	}
+#endif
+
+	if (c->file.off != 0) {
+		if (0 > fffile_seek(c->file.f, c->file.off, FFFILE_SEEK_BEGIN)) {
+			cl_syswarnlog(c, "fffile_seek: %s", c->file.buf.ptr);
+			return AHFILTER_ERR;
+		}
+		c->file.read = 1;
+	}
+	c->file.remain = c->resp.content_length;
+	c->file.rpos = c->file.off;
+
+	// the whole file must fit into a single read buffer
+	if (!(c->resp.content_length != 0
+		&& c->resp.content_length <= c->conf->fs.ocache_file_max_size
+		&& c->resp.content_length <= c->file.buf.cap))
+		c->file.ocache_add = 0;
+
 	return AHFILTER_FWD;
 }
 
+/** Read file data on the worker thread if it's in page cache
+Return N of bytes read;  <0: the data isn't cached: use asynchronous read */
+static ffssize f_read_nowait(alphahttpd_client *c, void *buf, ffsize n)
+{
+#if defined FF_LINUX && defined RWF_NOWAIT
+	if (cl_kcq_active(c)
+		|| c->kev->urtask_f.pending || c->kev->urtask_f.done)
+		return -1; // get the result of asynchronous read
+
+	// kcall reads from the current file position, io_uring uses explicit offset
+	off_t off = (c->si->file_read != NULL) ? (off_t)c->file.rpos : -1;
+	struct iovec iov = { buf, n };
+	ffssize r = preadv2(c->file.f, &iov, 1, off, RWF_NOWAIT);
+	if (r < 0) {
+		c->si->read_nowait_misses++;
+		return -1;
+	}
+	c->si->read_nowait_hits++;
+	cl_extralog(c, "fffile_read: %L bytes from page cache", r);
+	return r;
+#else
+	return -1;
+#endif
+}
+
 static int file_process(alphahttpd_client *c)
 {
 	ffssize r;
 	switch (c->file.state) {
-	case 0:
+	case F_LOOKUP:
+		// on asynchronous completion the filter is called again in the next state:
+		//  the lookups must not be repeated
+		if (0 == f_ocache_get(c))
+			return AHFILTER_DONE;
+		c->file.state = F_VARIANT;
+		// fallthrough
+
+	case F_VARIANT:
+	case F_VARIANT_OPEN:
+	case F_VARIANT_INFO:
+		if (AHFILTER_ASYNC == (r = f_variant(c)))
+			return r;
+
+		if (r == AHFILTER_FWD
+			|| 0 == f_cache_get(c)) {
+			c->file.state = F_DATA;
+			if (AHFILTER_FWD != (r = f_ready(c)))
+				return r;
+			break;
+		}
+		c->file.state = F_OPEN;
+		// fallthrough
+
+	case F_OPEN:
 		if (AHFILTER_FWD != (r = f_open(c)))
 			return r;
-		c->file.state = 1;
+		c->file.state = F_INFO;
 		// fallthrough
-	case 1:
+
+	case F_INFO:
 		if (AHFILTER_FWD != (r = f_info(c)))
 			return r;
-		c->file.state = 2;
+		c->file.state = F_DATA;
+		if (AHFILTER_FWD != (r = f_ready(c)))
+			return r;
+		break;
+
+	case F_OCACHE_ADD:
+		f_ocache_add(c);
+		c->resp_done = 1;
+		return AHFILTER_DONE;
+	}
+
+	if (c->file.remain == 0) {
+		c->resp_done = 1;
+		return AHFILTER_DONE;
 	}
 
+	c->file.read = 1;
+
 	if (cl_kcq_active(c))
 		cl_dbglog(c, "fffile_read: completed");
 
-	r = fffile_read_async(c->file.f, c->file.buf.ptr, c->file.buf.cap, cl_kcq(c));
+	ffsize n = ffmin64(c->file.buf.cap, c->file.remain);
+	if (0 > (r = f_read_nowait(c, c->file.buf.ptr, n))) {
+		int fixed = (c->file.fce != NULL) ? c->file.fce->fixed : -1;
+		r = cl_file_read(c, c->file.f, fixed, c->file.buf.ptr, n, c->file.rpos);
+	}
 	if (r < 0) {
 		if (fferr_last() == FFKCALL_EINPROGRESS) {
 			cl_dbglog(c, "fffile_read: in progress");
@@ -247,6 +906,13 @@ static int file_process(alphahttpd_client *c)
 		return AHFILTER_DONE;
 	}
 	c->file.buf.len = r;
+	c->file.remain -= r;
+	c->file.rpos += r;
+	if (c->file.ocache_add) {
+		c->file.ocache_add = 0;
+		if ((ffuint64)r == c->resp.content_length)
+			c->file.state = F_OCACHE_ADD;
+	}
 	ffstr_setstr(&c->output, &c->file.buf);
 	return AHFILTER_FWD;
 }
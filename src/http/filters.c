@@ -6,6 +6,7 @@
 #include <http/index.h>
 #include <http/autoindex.h>
 #include <http/file.h>
+#include <http/compress.h>
 #include <http/error.h>
 #include <http/transfer.h>
 #include <http/response.h>
@@ -18,6 +19,7 @@ const struct alphahttpd_filter* ah_filters[] = {
 	&alphahttpd_filter_index,
 	&alphahttpd_filter_autoindex,
 	&alphahttpd_filter_file,
+	&alphahttpd_filter_compress,
 	&alphahttpd_filter_error,
 	&alphahttpd_filter_transfer,
 	&alphahttpd_filter_response,
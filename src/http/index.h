@@ -1,7 +1,13 @@
 /** alphahttpd: index document
 2022, Simon Zolin */
 
+/* The index file names from conf->fs.index_filename are tried in order.
+The file is opened asynchronously (kcall or io_uring), so a slow disk doesn't block the worker.
+The result is taken from the worker's file cache, if possible;
+ nonexistent files are remembered there too. */
+
 #include <http/client.h>
+#include <http/fcache.h>
 #include <FFOS/file.h>
 
 static int index_open(alphahttpd_client *c)
@@ -10,42 +16,118 @@ static int index_open(alphahttpd_client *c)
 		|| *ffstr_last(&c->req.unescaped_path) != '/')
 		return AHFILTER_SKIP;
 
+	ffsize n = c->conf->fs.www.len + c->req.unescaped_path.len + c->conf->fs.index_filename.len + 1;
+	if (NULL == cl_buf_alloc(c, &c->index.buf, n)) {
+		cl_errlog(c, "no memory");
+		cl_resp_status(c, HTTP_500_INTERNAL_SERVER_ERROR);
+		return AHFILTER_SKIP;
+	}
+	ffstr *fn = (ffstr*)&c->index.buf;
+	ffstr_add2(fn, -1, &c->conf->fs.www);
+	ffstr_add2(fn, -1, &c->req.unescaped_path);
+	c->index.dir_len = fn->len;
+	c->index.names = c->conf->fs.index_filename;
 	return AHFILTER_FWD;
 }
 
 void index_close(alphahttpd_client *c)
 {
-	ffvec_free(&c->index.buf);
+	cl_buf_free(c, &c->index.buf);
 }
 
-/** ".../" -> ".../index.html" */
-int index_process(alphahttpd_client *c)
+/** Remember that the file doesn't exist */
+static void index_cache_notexist(alphahttpd_client *c, ffstr fn)
 {
-	if (0 == ffvec_addfmt(&c->index.buf, "%S%S%S%Z"
-		, &c->conf->fs.www, &c->req.unescaped_path, &c->conf->fs.index_filename)) {
-		cl_errlog(c, "no memory");
-		cl_resp_status(c, HTTP_500_INTERNAL_SERVER_ERROR);
-		return AHFILTER_DONE;
+	struct ahd_fcache *fc = c->si->fcache;
+	if (fc == NULL)
+		return;
+
+	fftime now = c->si->date(c->srv, NULL);
+	fffileinfo fi = {};
+	struct fcache_ent *e;
+	if (NULL != (e = fcache_add(fc, fn, FFFILE_NULL, &fi, now.sec)))
+		fcache_release(fc, e);
+}
+
+/** Check whether the file exists
+Return 1: exists;  0: doesn't exist;  AHFILTER_ASYNC */
+static int index_check(alphahttpd_client *c)
+{
+	ffstr fn = FFSTR_INITN(c->index.buf.ptr, c->index.buf.len - 1);
+	struct ahd_fcache *fc = c->si->fcache;
+
+	if (!c->index.async && fc != NULL) {
+		fftime now = c->si->date(c->srv, NULL);
+		struct fcache_ent *e;
+		if (NULL != (e = fcache_find(fc, fn, now.sec))) {
+			int exists = (e->fd != FFFILE_NULL);
+			fcache_release(fc, e);
+			cl_dbglog(c, "index: fcache: hit: %S", &fn);
+			return exists;
+		}
 	}
-	const char *fn = c->index.buf.ptr;
 
 	fffd fd;
-	if (FFFILE_NULL == (fd = fffile_open(fn, FFFILE_READONLY | FFFILE_NOATIME))) {
+	if (FFFILE_NULL == (fd = cl_file_open(c, fn.ptr, FFFILE_READONLY | FFFILE_NOATIME))) {
+		if (fferr_last() == FFKCALL_EINPROGRESS) {
+			c->index.async = 1;
+			return AHFILTER_ASYNC;
+		}
+		c->index.async = 0;
+
 		if (!fferr_notexist(fferr_last())) {
-			cl_syswarnlog(c, "index: fffile_open: %s", fn);
+			cl_syswarnlog(c, "index: fffile_open: %S", &fn);
+			return 0;
 		}
-		return AHFILTER_DONE;
+		index_cache_notexist(c, fn);
+		return 0;
 	}
-	cl_dbglog(c, "index: found %s", fn);
+	c->index.async = 0;
 	fffile_close(fd);
-	ffvec_free(&c->index.buf);
+	return 1;
+}
 
-	ffsize cap = c->req.unescaped_path.len;
-	if (0 == ffstr_growadd2(&c->req.unescaped_path, &cap, &c->conf->fs.index_filename)) {
-		cl_errlog(c, "no memory");
-		cl_resp_status(c, HTTP_500_INTERNAL_SERVER_ERROR);
+/** ".../" -> ".../index.html" */
+int index_process(alphahttpd_client *c)
+{
+	for (;;) {
+		if (!c->index.async) {
+			ffstr name;
+			do {
+				if (c->index.names.len == 0)
+					return AHFILTER_DONE; // no index file
+				ffstr_splitby(&c->index.names, ',', &name, &c->index.names);
+			} while (name.len == 0);
+
+			ffstr *fn = (ffstr*)&c->index.buf;
+			fn->len = c->index.dir_len;
+			ffstr_add2(fn, c->index.buf.cap, &name);
+			ffstr_add(fn, c->index.buf.cap, "", 1);
+			c->index.name = name;
+		}
+
+		int r = index_check(c);
+		if (r == AHFILTER_ASYNC)
+			return AHFILTER_ASYNC;
+		if (r == 1)
+			break;
+	}
+
+	cl_dbglog(c, "index: found %s", c->index.buf.ptr);
+
+	// the request filter has reserved space for the longest index file name
+	ffstr *path = &c->req.unescaped_path;
+	if (path->len + c->index.name.len > c->req.unescaped_path_cap) {
+		ffsize cap = path->len;
+		if (0 == ffstr_growadd2(path, &cap, &c->index.name)) {
+			cl_errlog(c, "no memory");
+			cl_resp_status(c, HTTP_500_INTERNAL_SERVER_ERROR);
+			return AHFILTER_DONE;
+		}
+		c->req.unescaped_path_cap = cap;
 		return AHFILTER_DONE;
 	}
+	ffstr_add2(path, c->req.unescaped_path_cap, &c->index.name);
 	return AHFILTER_DONE;
 }
 
@@ -0,0 +1,301 @@
+/** alphahttpd: in-memory cache of complete responses for small files, shared by all workers
+2023, Simon Zolin */
+
+/*
+ocache_new ocache_free
+ocache_hash
+ocache_find
+ocache_add
+*/
+
+/* Each object holds the complete response data (header and body) and is never modified after it's published.
+Readers look up objects in a hash table (linear probing) without locks:
+ an object pointer is valid until the end of the current worker's event loop iteration.
+Writers are serialized by a try-lock: when another worker is updating the cache, the update is just skipped.
+Replaced and evicted objects are freed later via QSBR;
+ until then their memory counts against the limit for new objects.
+When the cache is full, a new object is admitted only if it's accessed more often (TinyLFU)
+ than the least frequently used object among several sampled ones. */
+
+#pragma once
+#include <http/client.h>
+#include <util/qsbr.h>
+#include <util/tinylfu.h>
+#include <ffbase/murmurhash3.h>
+
+struct ocache_obj {
+	struct qsbr_node nd;
+	uint hash;
+	uint path_len;
+	ffint64 expire_sec;
+	uint hdr_len; // response header length
+	uint data_len; // header + body
+	char data[]; // header, body, path
+};
+
+#define OCACHE_TOMBSTONE  ((struct ocache_obj*)1)
+#define OCACHE_SAMPLE  8
+
+struct ocache_tbl {
+	struct qsbr_node nd;
+	uint mask;
+	struct ocache_obj *slots[];
+};
+
+struct ahd_ocache {
+	struct qsbr qsbr;
+	struct ocache_tbl *tbl;
+	char lock;
+
+	// writer-only:
+	ffsize size, max_size; // total size of the published objects
+	ffsize retired_size; // total size of the unpublished objects not yet freed;  limits admission
+	uint n, tombstones;
+	uint rand;
+};
+
+static inline const char* ocache_obj_path(const struct ocache_obj *o)
+{
+	return o->data + o->data_len;
+}
+
+static struct ocache_tbl* ocache_tbl_new(uint slots)
+{
+	struct ocache_tbl *t = ffmem_calloc(1, sizeof(struct ocache_tbl) + slots * sizeof(struct ocache_obj*));
+	if (t == NULL)
+		return NULL;
+	t->mask = slots - 1;
+	return t;
+}
+
+/**
+max_size: memory limit for cached objects
+workers: max. number of workers accessing the cache */
+static struct ahd_ocache* ocache_new(ffsize max_size, uint workers)
+{
+	struct ahd_ocache *oc = ffmem_new(struct ahd_ocache);
+	if (oc == NULL)
+		return NULL;
+	if (0 != qsbr_init(&oc->qsbr, workers))
+		goto err;
+
+	// 2 slots per a 256-byte object
+	uint slots = ffint_align_power2(ffmax(max_size / 128, 64));
+	slots = ffmin(slots, 1024*1024);
+	if (NULL == (oc->tbl = ocache_tbl_new(slots)))
+		goto err;
+
+	oc->max_size = max_size;
+	oc->rand = 1;
+	return oc;
+
+err:
+	qsbr_destroy(&oc->qsbr);
+	ffmem_free(oc);
+	return NULL;
+}
+
+/** Free cache memory after all workers have stopped */
+static void ocache_free(struct ahd_ocache *oc)
+{
+	if (oc == NULL) return;
+
+	struct ocache_tbl *t = oc->tbl;
+	for (uint i = 0;  i <= t->mask;  i++) {
+		if (t->slots[i] > OCACHE_TOMBSTONE)
+			ffmem_free(t->slots[i]);
+	}
+	ffmem_free(t);
+	qsbr_destroy(&oc->qsbr);
+	ffmem_free(oc);
+}
+
+static inline uint ocache_hash(ffstr path)
+{
+	return murmurhash3(path.ptr, path.len, 0x12345678);
+}
+
+/** Find a valid object
+Return NULL if not found */
+static const struct ocache_obj* ocache_find(struct ahd_ocache *oc, ffstr path, uint hash, ffint64 now_sec)
+{
+	const struct ocache_tbl *t = __atomic_load_n(&oc->tbl, __ATOMIC_ACQUIRE);
+	for (uint i = hash & t->mask;  ;  i = (i + 1) & t->mask) {
+		const struct ocache_obj *o = __atomic_load_n(&t->slots[i], __ATOMIC_ACQUIRE);
+		if (o == NULL)
+			return NULL;
+		if (o == OCACHE_TOMBSTONE)
+			continue;
+
+		if (o->hash == hash
+			&& o->path_len == path.len
+			&& !ffmem_cmp(ocache_obj_path(o), path.ptr, path.len)) {
+			if (now_sec >= o->expire_sec)
+				return NULL;
+			return o;
+		}
+	}
+}
+
+/** Unpublish the object */
+static void ocache_rm(struct ahd_ocache *oc, uint i)
+{
+	struct ocache_obj *o = oc->tbl->slots[i];
+	__atomic_store_n(&oc->tbl->slots[i], OCACHE_TOMBSTONE, __ATOMIC_RELEASE);
+	qsbr_retire(&oc->qsbr, &o->nd);
+	oc->size -= o->nd.size;
+	oc->retired_size += o->nd.size;
+	oc->n--;
+	oc->tombstones++;
+}
+
+/** Replace the table with a new one without tombstones */
+static int ocache_rebuild(struct ahd_ocache *oc)
+{
+	struct ocache_tbl *old = oc->tbl, *t;
+	if (NULL == (t = ocache_tbl_new(old->mask + 1)))
+		return -1;
+
+	for (uint i = 0;  i <= old->mask;  i++) {
+		struct ocache_obj *o = old->slots[i];
+		if (o <= OCACHE_TOMBSTONE)
+			continue;
+		uint k = o->hash & t->mask;
+		while (t->slots[k] != NULL) {
+			k = (k + 1) & t->mask;
+		}
+		t->slots[k] = o;
+	}
+
+	__atomic_store_n(&oc->tbl, t, __ATOMIC_RELEASE);
+	old->nd.size = 0;
+	qsbr_retire(&oc->qsbr, &old->nd);
+	oc->tombstones = 0;
+	return 0;
+}
+
+/** Find the least frequently used object among several random ones
+skip: slot index of the object which must not be chosen;  -1: none
+Return slot index;  -1 if not found */
+static int ocache_victim(struct ahd_ocache *oc, const struct tinylfu *freq, int skip, uint *victim_freq)
+{
+	const struct ocache_tbl *t = oc->tbl;
+	oc->rand = oc->rand * 1103515245 + 12345;
+	uint i = oc->rand & t->mask, found = 0;
+	int victim = -1;
+	*victim_freq = (uint)-1;
+
+	for (uint k = 0;  k <= t->mask && found != OCACHE_SAMPLE;  k++, i = (i + 1) & t->mask) {
+		const struct ocache_obj *o = t->slots[i];
+		if (o <= OCACHE_TOMBSTONE || (int)i == skip)
+			continue;
+		found++;
+		uint f = tinylfu_estimate(freq, o->hash);
+		if (f < *victim_freq) {
+			*victim_freq = f;
+			victim = i;
+		}
+	}
+	return victim;
+}
+
+/** Make room for a new object, evicting less frequently used objects
+existing: slot index of the object being replaced;  -1: none
+Return 0 if the object is admitted */
+static int ocache_admit(struct ahd_ocache *oc, ffsize size, uint hash, const struct tinylfu *freq, int existing)
+{
+	ffsize replaced = 0;
+	uint n = oc->n;
+	if (existing >= 0) {
+		replaced = oc->tbl->slots[existing]->nd.size;
+		n--;
+	}
+
+	// the memory of the objects retired before isn't freed until all workers pass a quiescent state
+	ffsize retired = oc->retired_size;
+	if (retired + size > oc->max_size)
+		return -1;
+
+	uint f = tinylfu_estimate(freq, hash), vf;
+	while (oc->size - replaced + retired + size > oc->max_size
+		|| n == (oc->tbl->mask + 1) / 2) {
+
+		int i = ocache_victim(oc, freq, existing, &vf);
+		if (i < 0 || vf >= f)
+			return -1;
+		ocache_rm(oc, i);
+		n--;
+	}
+	return 0;
+}
+
+/** Add new object or replace the existing one.
+path: key
+hdr: complete response header
+body: complete response body
+freq: access frequencies seen by the current worker
+Return 0 on success
+ -1: the cache is being updated by another worker, or the object isn't admitted */
+static int ocache_add(struct ahd_ocache *oc, ffstr path, uint hash, ffstr hdr, ffstr body
+	, ffint64 expire_sec, const struct tinylfu *freq)
+{
+	if (__atomic_test_and_set(&oc->lock, __ATOMIC_ACQUIRE))
+		return -1; // don't wait for another writer
+
+	int rc = -1;
+	struct ocache_obj *o = NULL;
+	oc->retired_size -= qsbr_reclaim(&oc->qsbr);
+
+	if (oc->n + oc->tombstones + 1 > (oc->tbl->mask + 1) / 4 * 3
+		&& 0 != ocache_rebuild(oc))
+		goto end;
+
+	// find the existing object
+	struct ocache_tbl *t = oc->tbl;
+	uint i;
+	int existing = -1;
+	for (i = hash & t->mask;  t->slots[i] != NULL;  i = (i + 1) & t->mask) {
+		const struct ocache_obj *e = t->slots[i];
+		if (e != OCACHE_TOMBSTONE
+			&& e->hash == hash
+			&& e->path_len == path.len
+			&& !ffmem_cmp(ocache_obj_path(e), path.ptr, path.len)) {
+			existing = i;
+			break;
+		}
+	}
+
+	// the existing object is replaced only if the new one is admitted
+	ffsize size = sizeof(struct ocache_obj) + hdr.len + body.len + path.len;
+	if (size > oc->max_size
+		|| 0 != ocache_admit(oc, size, hash, freq, existing))
+		goto end;
+
+	if (NULL == (o = ffmem_alloc(size)))
+		goto end;
+	if (existing >= 0)
+		ocache_rm(oc, existing);
+	o->nd.size = size;
+	o->hash = hash;
+	o->path_len = path.len;
+	o->expire_sec = expire_sec;
+	o->hdr_len = hdr.len;
+	o->data_len = hdr.len + body.len;
+	ffmem_copy(o->data, hdr.ptr, hdr.len);
+	ffmem_copy(o->data + hdr.len, body.ptr, body.len);
+	ffmem_copy(o->data + o->data_len, path.ptr, path.len);
+
+	// insert into the first free slot
+	for (i = hash & t->mask;  t->slots[i] > OCACHE_TOMBSTONE;  i = (i + 1) & t->mask) {
+	}
+	if (t->slots[i] == OCACHE_TOMBSTONE)
+		oc->tombstones--;
+	__atomic_store_n(&t->slots[i], o, __ATOMIC_RELEASE);
+	oc->n++;
+	oc->size += size;
+	rc = 0;
+
+end:
+	__atomic_clear(&oc->lock, __ATOMIC_RELEASE);
+	return rc;
+}
@@ -11,6 +11,8 @@ static int ahrecv_open(alphahttpd_client *c)
 static void ahrecv_close(alphahttpd_client *c)
 {
 	cl_timer_stop(c, &c->recv.timer);
+	if (!c->ka)
+		cl_buf_free(c, &c->req.buf); // the connection is closing, maybe before 'request' filter has been opened
 }
 
 static void ahreq_read_expired(alphahttpd_client *c)
@@ -29,13 +31,13 @@ static int ahrecv_read(alphahttpd_client *c)
 	}
 
 	if (c->req.buf.cap == 0) {
-		if (NULL == ffvec_alloc(&c->req.buf, c->conf->receive.buf_size, 1)) {
+		if (NULL == cl_buf_alloc(c, &c->req.buf, c->conf->receive.buf_size)) {
 			cl_syswarnlog(c, "no memory");
 			return AHFILTER_ERR;
 		}
 	}
 
-	int r = ffsock_recv_async(c->sk, c->req.buf.ptr + c->req.buf.len, c->req.buf.cap - c->req.buf.len, cl_kev_r(c));
+	int r = cl_recv(c, c->req.buf.ptr + c->req.buf.len, cl_req_buf_cap(c) - c->req.buf.len);
 	if (r < 0) {
 		if (fferr_last() == FFSOCK_EINPROGRESS) {
 			cl_timer(c, &c->recv.timer, c->conf->receive.timeout_sec, ahreq_read_expired, c);
@@ -0,0 +1,131 @@
+/** alphahttpd: read request body
+2023, Simon Zolin */
+
+/* The body (Content-Length or chunked) is decoded in the receive buffer
+ and passed to the next filters part by part.
+The data is read from the socket only after the next filters have consumed the previous part (they return BACK),
+ so the memory usage is bounded by the size of the receive buffer.
+The receive buffer holds the request headers, followed by the raw body data:
+	[HEADERS] [RAW BODY DATA...]
+	          ^ req.full.len  ^ reqbody.off
+After the body is read, the data following it (the next pipelined request) is left in the buffer. */
+
+#include <http/client.h>
+
+static int ahbody_open(alphahttpd_client *c)
+{
+	if (!c->req_body || c->resp_err)
+		return AHFILTER_SKIP;
+
+	c->reqbody.off = c->req.full.len;
+	c->reqbody.opened = 1;
+	return AHFILTER_FWD;
+}
+
+static void ahbody_close(alphahttpd_client *c)
+{
+}
+
+/** Allow the client to send the body if it waits for our confirmation ("Expect: 100-continue") */
+static void ahbody_continue(alphahttpd_client *c)
+{
+	if (c->reqbody.continue_sent)
+		return;
+	c->reqbody.continue_sent = 1;
+
+	ffstr expect = cl_req_hdr(c, HTTP_H_EXPECT);
+	if (!c->req_http11
+		|| !ffstr_ieqcz(&expect, "100-continue"))
+		return;
+
+	// Nothing else is being sent at this point, so the data normally fits into the socket buffer.
+	// Otherwise the client starts sending the body after its timeout.
+	static const char resp[] = "HTTP/1.1 100 Continue\r\n\r\n";
+	if (FFS_LEN(resp) != ffsock_send(c->sk, resp, FFS_LEN(resp), 0))
+		cl_dbglog(c, "ffsock_send: 100 Continue: %E", fferr_last());
+}
+
+/** Prepare the buffer for more data */
+static int ahbody_more(alphahttpd_client *c)
+{
+	ffvec *b = &c->req.buf;
+	b->len = c->req.full.len;
+	c->reqbody.off = b->len;
+
+	// read the body in large blocks;  the buffer may also receive the next pipelined request
+	ffsize max = ffmin(c->conf->receive.buf_max_size, RANGE16_MAX);
+	if (b->cap < max) {
+		cl_dbglog(c, "receive buffer: %L -> %L", b->cap, max);
+		if (0 != cl_buf_realloc(c, b, max)) {
+			cl_syswarnlog(c, "no memory");
+			return -1;
+		}
+	}
+	if (b->len == cl_req_buf_cap(c)) {
+		cl_warnlog(c, "reached `receive.buf_max_size` limit");
+		return -1;
+	}
+
+	ahbody_continue(c);
+	return 0;
+}
+
+static int ahbody_process(alphahttpd_client *c)
+{
+	ffvec *b = &c->req.buf;
+
+	if (c->chain_back) {
+		// the previous part is consumed: move the unprocessed data to the beginning of body region
+		ffsize n = b->len - c->reqbody.off;
+		ffmem_move((char*)b->ptr + c->req.full.len, (char*)b->ptr + c->reqbody.off, n);
+		b->len = c->req.full.len + n;
+		c->reqbody.off = c->req.full.len;
+	}
+
+	for (;;) {
+		ffstr in = FFSTR_INITN((char*)b->ptr + c->reqbody.off, b->len - c->reqbody.off), out = {};
+
+		if (c->req_body_chunked) {
+			ffssize r = httpchunked_parse(&c->reqbody.chunked, in, &out);
+			if (r == -1) {
+				c->reqbody.off += c->reqbody.chunked.done_len;
+				c->reqbody.complete = 1;
+			} else if (r < 0) {
+				cl_warnlog(c, "bad chunked data");
+				return AHFILTER_ERR;
+			} else {
+				c->reqbody.off += r;
+			}
+
+		} else {
+			ffsize n = ffmin64(c->reqbody.remain, in.len);
+			ffstr_set(&out, in.ptr, n);
+			c->reqbody.off += n;
+			c->reqbody.remain -= n;
+			if (c->reqbody.remain == 0)
+				c->reqbody.complete = 1;
+		}
+
+		if (c->reqbody.complete) {
+			cl_dbglog(c, "request body: complete");
+			c->output = out;
+			return AHFILTER_DONE;
+		}
+
+		if (out.len != 0) {
+			c->output = out;
+			return AHFILTER_FWD;
+		}
+
+		if (c->reqbody.off == b->len)
+			break;
+	}
+
+	if (0 != ahbody_more(c))
+		return AHFILTER_ERR;
+	return AHFILTER_BACK;
+}
+
+const struct alphahttpd_filter alphahttpd_filter_reqbody = {
+	ahbody_open, ahbody_close, ahbody_process
+};
@@ -16,14 +16,85 @@ static void ahreq_close(alphahttpd_client *c)
 {
 	if (c->ka) {
 		// preserve pipelined data
-		ffstr_erase_left((ffstr*)&c->req.buf, c->req.full.len);
+		ffsize n = c->req.full.len;
+		if (c->reqbody.complete)
+			n = c->reqbody.off; // the body has been read too
+		ffstr_erase_left((ffstr*)&c->req.buf, n);
 		c->req_unprocessed_data = (c->req.buf.len != 0);
+		if (!c->req_unprocessed_data) {
+			cl_buf_free(c, &c->req.buf); // idle keep-alive connection doesn't hold the buffer
+		} else if (c->req.buf.cap > c->conf->receive.buf_size
+			&& c->req.buf.len <= c->conf->receive.buf_size) {
+			// the buffer has been grown for this request: the next one starts with the default size
+			if (0 != cl_buf_realloc(c, &c->req.buf, c->conf->receive.buf_size))
+				cl_syswarnlog(c, "no memory");
+		}
 	} else {
-		ffvec_free(&c->req.buf);
+		cl_buf_free(c, &c->req.buf);
 	}
 	ffstr_free(&c->req.unescaped_path);
 }
 
+/** Get the length of request body
+Return 0 on success */
+static int ahreq_body(alphahttpd_client *c)
+{
+	if (c->req_body_hdr_conflict) {
+		// the body length is ambiguous: another server on the path may use the other value
+		cl_warnlog(c, "conflicting Content-Length or Transfer-Encoding");
+		cl_resp_status(c, HTTP_400_BAD_REQUEST);
+		return -1;
+	}
+
+	if (c->req.hdr[HTTP_H_TRANSFER_ENCODING].off != 0) {
+		if (!c->req_http11
+			|| c->req.hdr[HTTP_H_CONTENT_LENGTH].off != 0) {
+			// the body length is ambiguous: don't let the data be interpreted as another request
+			cl_warnlog(c, "bad Transfer-Encoding");
+			cl_resp_status(c, HTTP_400_BAD_REQUEST);
+			return -1;
+		}
+		ffstr te = cl_req_hdr(c, HTTP_H_TRANSFER_ENCODING);
+		if (!ffstr_ieqcz(&te, "chunked")) {
+			cl_warnlog(c, "unsupported Transfer-Encoding: %S", &te);
+			cl_resp_status(c, HTTP_501_NOT_IMPLEMENTED);
+			return -1;
+		}
+		c->req_body = 1;
+		c->req_body_chunked = 1;
+
+	} else if (c->req.hdr[HTTP_H_CONTENT_LENGTH].off != 0) {
+		ffstr cl = cl_req_hdr(c, HTTP_H_CONTENT_LENGTH);
+		if (cl.len == 0
+			|| cl.len != ffstr_toint(&cl, &c->reqbody.remain, FFS_INT64)) {
+			cl_warnlog(c, "bad Content-Length");
+			cl_resp_status(c, HTTP_400_BAD_REQUEST);
+			return -1;
+		}
+		c->req_body = (c->reqbody.remain != 0);
+	}
+	return 0;
+}
+
+/** Move the data to a larger buffer.
+The parsed data is referenced by offsets, so it remains valid. */
+static int ahreq_buf_grow(alphahttpd_client *c)
+{
+	ffsize max = ffmin(c->conf->receive.buf_max_size, RANGE16_MAX);
+	if (c->req.buf.len >= max) {
+		cl_warnlog(c, "reached `receive.buf_max_size` limit");
+		return -1;
+	}
+
+	ffsize cap = ffmin(c->req.buf.cap * 2, max);
+	cl_dbglog(c, "receive buffer: %L -> %L", c->req.buf.cap, cap);
+	if (0 != cl_buf_realloc(c, &c->req.buf, cap)) {
+		cl_syswarnlog(c, "no memory");
+		return -1;
+	}
+	return 0;
+}
+
 static int ahreq_read(alphahttpd_client *c)
 {
 	if (c->req_unprocessed_data) {
@@ -34,10 +105,9 @@ static int ahreq_read(alphahttpd_client *c)
 		return AHFILTER_DONE;
 	}
 
-	if (c->req.buf.len == c->req.buf.cap) {
-		cl_warnlog(c, "reached `read_buf_size` limit");
+	if (c->req.buf.len == cl_req_buf_cap(c)
+		&& 0 != ahreq_buf_grow(c))
 		return AHFILTER_ERR;
-	}
 
 	return AHFILTER_BACK;
 }
@@ -60,18 +130,26 @@ static int ahreq_parse(alphahttpd_client *c)
 	if (c->log_level >= ALPHAHTTPD_LOG_DEBUG)
 		t_begin = fftime_monotonic();
 
-	r = http_req_parse(req, &method, &url, &proto);
-	if (r == 0)
-		return 1;
-	else if (r < 0) {
-		cl_resp_status(c, HTTP_400_BAD_REQUEST);
-		return 0;
+	if (c->req.parsed == 0) {
+		r = http_req_parse(req, &method, &url, &proto);
+		if (r == 0)
+			return 1;
+		else if (r < 0) {
+			cl_resp_status(c, HTTP_400_BAD_REQUEST);
+			return 0;
+		}
+
+		range16_set(&c->req.line, 0, r-1);
+		if (req.ptr[r-2] == '\r')
+			c->req.line.len--;
+		range16_set(&c->req.method, method.ptr - buf, method.len);
+		range16_set(&c->req.url, url.ptr - buf, url.len);
+		c->req_http11 = (proto.ptr[7] == '1');
+		c->req.parsed = r;
 	}
 
-	range16_set(&c->req.line, 0, r-1);
-	if (req.ptr[r-2] == '\r')
-		c->req.line.len--;
-	ffstr_shift(&req, r);
+	// continue after the last complete header line
+	ffstr_shift(&req, c->req.parsed);
 
 	ffstr name = {}, val = {};
 	for (;;) {
@@ -88,18 +166,23 @@ static int ahreq_parse(alphahttpd_client *c)
 
 		if (r <= 2)
 			break;
-
-		if (ffstr_ieqcz(&name, "Host") && c->req.host.len == 0) {
-			range16_set(&c->req.host, val.ptr - buf, val.len);
-
-		} else if (ffstr_ieqcz(&name, "Connection")) {
-			if (ffstr_ieqcz(&val, "keep-alive"))
-				ka = 1;
-			else if (ffstr_ieqcz(&val, "close"))
-				ka = -1;
-
-		} else if (ffstr_ieqcz(&name, "If-Modified-Since")) {
-			range16_set(&c->req.if_modified_since, val.ptr - buf, val.len);
+		c->req.parsed += r;
+
+		int id;
+		if (0 <= (id = http_hdr_id(name))) {
+			if (c->req.hdr[id].off == 0) { // the first field wins
+				range16_set(&c->req.hdr[id], val.ptr - buf, val.len);
+
+			} else if (id == HTTP_H_CONTENT_LENGTH || id == HTTP_H_TRANSFER_ENCODING) {
+				ffstr first = cl_req_hdr(c, id);
+				if (!ffstr_eq2(&first, &val))
+					c->req_body_hdr_conflict = 1;
+			}
+
+		} else if (c->req.hdr_other_n != AHD_HDR_OTHER_MAX) {
+			uint i = c->req.hdr_other_n++;
+			range16_set(&c->req.hdr_other[i].name, name.ptr - buf, name.len);
+			range16_set(&c->req.hdr_other[i].val, val.ptr - buf, val.len);
 		}
 	}
 
@@ -107,27 +190,38 @@ static int ahreq_parse(alphahttpd_client *c)
 
 	range16_set(&c->req.full, 0, req.ptr - buf);
 
-	c->resp_connection_keepalive = (proto.ptr[7] == '1');
+	ffstr conn = cl_req_hdr(c, HTTP_H_CONNECTION);
+	if (ffstr_ieqcz(&conn, "keep-alive"))
+		ka = 1;
+	else if (ffstr_ieqcz(&conn, "close"))
+		ka = -1;
+
+	c->resp_connection_keepalive = c->req_http11;
 	if (ka > 0)
 		c->resp_connection_keepalive = 1;
 	else if (ka < 0)
 		c->resp_connection_keepalive = 0;
 
-	if (proto.ptr[7] == '1' && c->req.host.len == 0) {
+	if (c->req_http11 && c->req.hdr[HTTP_H_HOST].len == 0) {
 		cl_warnlog(c, "no host");
 		cl_resp_status(c, HTTP_400_BAD_REQUEST);
 		return 0;
 	}
 
+	if (0 != ahreq_body(c))
+		return 0;
+
 	struct httpurl_parts parts = {};
+	url = range16_tostr(&c->req.url, buf);
 	httpurl_split(&parts, url);
 
-	range16_set(&c->req.method, method.ptr - buf, method.len);
 	range16_set(&c->req.path, parts.path.ptr - buf, parts.path.len);
 	range16_set(&c->req.querystr, parts.query.ptr - buf, parts.query.len);
 
 	r = httpurl_unescape(NULL, 0, parts.path);
-	if (NULL == ffstr_alloc(&c->req.unescaped_path, r)) {
+	// reserve space for index file name
+	c->req.unescaped_path_cap = r + c->conf->fs.index_filename.len;
+	if (NULL == ffstr_alloc(&c->req.unescaped_path, c->req.unescaped_path_cap)) {
 		cl_errlog(c, "no memory");
 		cl_resp_status(c, HTTP_500_INTERNAL_SERVER_ERROR);
 		return 0;
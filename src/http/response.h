@@ -5,7 +5,9 @@
 
 static int ahresp_open(alphahttpd_client *c)
 {
-	if (NULL == ffvec_alloc(&c->resp.buf, c->conf->response.buf_size, 1)) {
+	if (c->resp_cached)
+		return AHFILTER_SKIP;
+	if (NULL == cl_buf_alloc(c, &c->resp.buf, c->conf->response.buf_size)) {
 		cl_syswarnlog(c, "no memory");
 		return AHFILTER_ERR;
 	}
@@ -14,8 +16,7 @@ static int ahresp_open(alphahttpd_client *c)
 
 static void ahresp_close(alphahttpd_client *c)
 {
-	ffvec_free(&c->resp.buf);
-	ffstr_free(&c->resp.last_modified);
+	cl_buf_free(c, &c->resp.buf);
 }
 
 static int ahresp_process(alphahttpd_client *c)
@@ -33,6 +34,8 @@ static int ahresp_process(alphahttpd_client *c)
 		d += _ffs_copycz(d, end - d, "Content-Length: ");
 		d += ffs_fromint(c->resp.content_length, d, end - d, 0);
 		d += _ffs_copycz(d, end - d, "\r\n");
+	} else if (c->transfer.chunked) {
+		d += _ffs_copycz(d, end - d, "Transfer-Encoding: chunked\r\n");
 	}
 
 	ffstr val;
@@ -42,12 +45,30 @@ static int ahresp_process(alphahttpd_client *c)
 	if (c->resp.last_modified.len)
 		d += http_hdr_write(d, end - d, FFSTR_Z("Last-Modified"), c->resp.last_modified);
 
+	if (c->resp.etag.len)
+		d += http_hdr_write(d, end - d, FFSTR_Z("ETag"), c->resp.etag);
+
 	if (c->resp.content_type.len)
 		d += http_hdr_write(d, end - d, FFSTR_Z("Content-Type"), c->resp.content_type);
 
+	if (c->resp.content_encoding.len)
+		d += http_hdr_write(d, end - d, FFSTR_Z("Content-Encoding"), c->resp.content_encoding);
+
+	if (c->resp_vary_encoding)
+		d += _ffs_copycz(d, end - d, "Vary: Accept-Encoding\r\n");
+
+	if (c->resp_accept_ranges)
+		d += _ffs_copycz(d, end - d, "Accept-Ranges: bytes\r\n");
+
+	if (c->resp.content_range.len)
+		d += http_hdr_write(d, end - d, FFSTR_Z("Content-Range"), c->resp.content_range);
+
 	if (c->conf->response.server_name.len)
 		d += http_hdr_write(d, end - d, FFSTR_Z("Server"), c->conf->response.server_name);
 
+	if (c->req_body && !c->reqbody.complete)
+		c->resp_connection_keepalive = 0; // the rest of request body can't be used as the next request
+
 	ffstr_setz(&val, "keep-alive");
 	if (!c->resp_connection_keepalive)
 		ffstr_setz(&val, "close");
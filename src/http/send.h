@@ -2,6 +2,11 @@
 2022, Simon Zolin */
 
 #include <http/client.h>
+#ifdef AHD_HAVE_SENDFILE
+#ifdef FF_LINUX
+#include <sys/sendfile.h>
+#endif
+#endif
 
 static int ahsend_open(alphahttpd_client *c)
 {
@@ -11,6 +16,7 @@ static int ahsend_open(alphahttpd_client *c)
 static void ahsend_close(alphahttpd_client *c)
 {
 	cl_timer_stop(c, &c->send.timer);
+	cl_buf_free(c, &c->send.buf);
 }
 
 static void ahsend_expired(alphahttpd_client *c)
@@ -19,6 +25,87 @@ static void ahsend_expired(alphahttpd_client *c)
 	c->si->cl_destroy(c);
 }
 
+/** Copy the rest of response data from the shared in-memory cache,
+ because the shared data must not be used after the current event loop iteration */
+static int ahsend_unshare(alphahttpd_client *c)
+{
+	ffstr d = c->send.shared;
+	ffstr_shift(&d, c->send.transferred);
+	ffstr_null(&c->send.shared);
+
+	if (NULL == cl_buf_alloc(c, &c->send.buf, d.len)) {
+		cl_errlog(c, "no memory");
+		return -1;
+	}
+	ffmem_copy(c->send.buf.ptr, d.ptr, d.len);
+	c->send.buf.len = d.len;
+	ffiovec_set(&c->send.iov[0], c->send.buf.ptr, d.len);
+	c->send.iov_n = 1;
+	return 0;
+}
+
+#ifdef AHD_HAVE_SENDFILE
+
+/** Send data and tell the kernel that more data (file) follows,
+ so that the response header and file data may be sent in one TCP segment. */
+static int ahsend_more(alphahttpd_client *c)
+{
+	int flags = 0;
+#ifdef MSG_MORE
+	flags = MSG_MORE;
+#endif
+	struct msghdr m = {};
+	m.msg_iov = c->send.iov;
+	m.msg_iovlen = c->send.iov_n;
+	int r = sendmsg(c->sk, &m, flags);
+	if (r < 0 && fferr_last() == EAGAIN) {
+		c->kev->wtask.active = 1;
+		fferr_set(FFSOCK_EINPROGRESS);
+	}
+	return r;
+}
+
+/** Send file data without copying it to user-space */
+static int ahsend_file(alphahttpd_client *c)
+{
+	while (c->send.file_off != c->send.file_end) {
+		ffsize n = ffmin64(c->send.file_end - c->send.file_off, 0x7ffff000);
+		ffssize r;
+
+#ifdef FF_LINUX
+		off_t off = c->send.file_off;
+		r = sendfile(c->sk, c->send.file, &off, n);
+#else // FreeBSD
+		off_t sbytes = 0;
+		r = sendfile(c->send.file, c->sk, c->send.file_off, n, NULL, &sbytes, 0);
+		if (r == 0 || (fferr_last() == EAGAIN && sbytes != 0))
+			r = sbytes;
+#endif
+
+		if (r < 0) {
+			if (fferr_last() == EAGAIN) {
+				c->kev->wtask.active = 1;
+				cl_timer(c, &c->send.timer, c->conf->send.timeout_sec, ahsend_expired, c);
+				cl_async(c);
+				return AHFILTER_ASYNC;
+			}
+			cl_syswarnlog(c, "sendfile");
+			return AHFILTER_ERR;
+		} else if (r == 0) {
+			cl_warnlog(c, "sendfile: file size has changed");
+			return AHFILTER_ERR;
+		}
+
+		cl_dbglog(c, "sendfile: %L", (ffsize)r);
+		c->send.file_off += r;
+		c->send.transferred += r;
+	}
+	c->kev->wtask.active = 0;
+	return AHFILTER_DONE;
+}
+
+#endif
+
 static int ahsend_process(alphahttpd_client *c)
 {
 	if (!c->send_init) {
@@ -34,10 +121,24 @@ static int ahsend_process(alphahttpd_client *c)
 		c->input.len = 0;
 	}
 
+	if (c->send.shared.len != 0
+		&& c->conf->server.io_uring
+		&& 0 != ahsend_unshare(c))
+		return AHFILTER_ERR;
+
 	while (c->send.iov_n != 0) {
-		int r = ffsock_sendv_async(c->sk, c->send.iov, c->send.iov_n, cl_kev_w(c));
+		int r;
+#ifdef AHD_HAVE_SENDFILE
+		if (c->send.file_off != c->send.file_end)
+			r = ahsend_more(c);
+		else
+#endif
+			r = cl_sendv(c, c->send.iov, c->send.iov_n);
 		if (r < 0) {
 			if (fferr_last() == FFSOCK_EINPROGRESS) {
+				if (c->send.shared.len != 0
+					&& 0 != ahsend_unshare(c))
+					return AHFILTER_ERR;
 				cl_timer(c, &c->send.timer, c->conf->send.timeout_sec, ahsend_expired, c);
 				cl_async(c);
 				return AHFILTER_ASYNC;
@@ -55,6 +156,14 @@ static int ahsend_process(alphahttpd_client *c)
 		}
 	}
 
+#ifdef AHD_HAVE_SENDFILE
+	if (c->send.file_off != c->send.file_end) {
+		int r = ahsend_file(c);
+		if (r != AHFILTER_DONE)
+			return r;
+	}
+#endif
+
 	cl_timer_stop(c, &c->send.timer);
 	if (c->resp_done)
 		return AHFILTER_DONE;
@@ -5,9 +5,19 @@
 
 static int ahtrans_open(alphahttpd_client *c)
 {
-	if (c->resp.content_length == (ffuint64)-1) {
-		c->resp_connection_keepalive = 0;
+	if (c->resp_cached)
 		return AHFILTER_SKIP;
+	if (c->resp.content_length == (ffuint64)-1) {
+		if (c->resp.code == 304) // 304 response has no body
+			return AHFILTER_SKIP;
+		if (!c->req_http11) {
+			c->resp_connection_keepalive = 0;
+			return AHFILTER_SKIP;
+		}
+		// the length is unknown: send data in chunks
+		//  (the response to HEAD has the same header fields, but no data)
+		c->transfer.chunked = 1;
+		return AHFILTER_FWD;
 	}
 	c->transfer.cont_len = c->resp.content_length;
 	return AHFILTER_FWD;
@@ -15,6 +25,41 @@ static int ahtrans_open(alphahttpd_client *c)
 
 static void ahtrans_close(alphahttpd_client *c)
 {
+	cl_buf_free(c, &c->transfer.buf);
+}
+
+/** Copy data into a chunk: "SIZE CRLF DATA CRLF", and the last chunk "0 CRLF CRLF" */
+static int ahtrans_chunked(alphahttpd_client *c)
+{
+	ffsize cap = 18 + c->input.len + 2 + FFS_LEN("0\r\n\r\n");
+	if (c->transfer.buf.cap < cap) {
+		cl_buf_free(c, &c->transfer.buf);
+		if (NULL == cl_buf_alloc(c, &c->transfer.buf, cap)) {
+			cl_errlog(c, "no memory");
+			return AHFILTER_ERR;
+		}
+	}
+
+	ffstr *d = (ffstr*)&c->transfer.buf;
+	d->len = 0;
+	if (c->input.len != 0) {
+		ffstr hdr, trl;
+		httpchunked_write(d->ptr, c->input.len, &hdr, &trl);
+		d->len = hdr.len;
+		ffstr_add2(d, -1, &c->input);
+		ffstr_add2(d, -1, &trl);
+	}
+
+	if (c->resp_done) {
+		ffstr_add(d, -1, "0\r\n\r\n", 5);
+		ffstr_setstr(&c->output, d);
+		return AHFILTER_DONE;
+	}
+
+	if (d->len == 0)
+		return AHFILTER_BACK;
+	ffstr_setstr(&c->output, d);
+	return AHFILTER_FWD;
 }
 
 static int ahtrans_process(alphahttpd_client *c)
@@ -22,6 +67,9 @@ static int ahtrans_process(alphahttpd_client *c)
 	if (c->chain_back)
 		return AHFILTER_BACK;
 
+	if (c->transfer.chunked)
+		return ahtrans_chunked(c);
+
 	ffsize n = ffmin64(c->input.len, c->transfer.cont_len);
 	ffstr_set(&c->output, c->input.ptr, n);
 	c->transfer.cont_len -= n;
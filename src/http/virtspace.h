@@ -64,7 +64,22 @@ static int map_keyeq_func(void *opaque, const void *key, ffsize keylen, void *va
 
 static int ahvspc_process(alphahttpd_client *c)
 {
-	c->vspace.vdoc->handler(c);
+	const struct alphahttpd_virtdoc *d = c->vspace.vdoc;
+
+	if (c->req_body && c->reqbody.opened && d->body != NULL) {
+		// pass each part of the request body from 'reqbody' filter
+		if (c->input.len != 0 || c->reqbody.complete) {
+			if (0 != d->body(c, c->input, c->reqbody.complete)) {
+				if (c->resp.code == 0)
+					cl_resp_status(c, HTTP_400_BAD_REQUEST);
+				return AHFILTER_DONE;
+			}
+		}
+		if (!c->reqbody.complete)
+			return AHFILTER_BACK;
+	}
+
+	d->handler(c);
 
 	if (c->resp.content_length == ~0ULL) {
 		cl_resp_status_ok(c, HTTP_200_OK);
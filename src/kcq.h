@@ -1,15 +1,44 @@
 /** alphahttpd: kernel call queue workers
 2022, Simon Zolin */
 
+/* There are several submission queues, each with its own semaphore.
+Each HTTP worker submits requests to one queue (assigned in kcq_set()).
+Each kcall thread is bound to one queue;
+ when the queue is empty, the thread processes the requests from other queues before going to sleep.
+Blocking tasks (struct alphahttpd_task) are put into a separate queue shared by all threads:
+ the semaphores of the submission queues are signalled in turn. */
+
+struct kcq_queue {
+	ffringqueue *sq;
+	ffsem sem;
+};
+
 int kcq_init()
 {
-	if (NULL == (boss->kcq_sq = ffrq_alloc(ahd_conf->aconf.server.max_connections))) {
+	uint n = ffmin(ahd_conf->workers_n, ahd_conf->kcall_workers);
+	n = ffmax(n, 1);
+	if (NULL == ffvec_zallocT(&boss->kcq_queues, n, struct kcq_queue))
 		return -1;
-	}
-	if (!ahd_conf->aconf.server.polling_mode
-		&& FFSEM_NULL == (boss->kcq_sem = ffsem_open(NULL, 0, 0))) {
+	if (NULL == (boss->kcq_tasks = ffrq_alloc(ahd_conf->aconf.server.max_connections * ahd_conf->workers_n)))
 		return -1;
+	boss->kcq_queues.len = n;
+
+	// each queue is used by up to this number of HTTP workers
+	uint workers_per_queue = (ahd_conf->workers_n + n - 1) / n;
+	workers_per_queue = ffmax(workers_per_queue, 1);
+
+	struct kcq_queue *q;
+	FFSLICE_WALK(&boss->kcq_queues, q) {
+		q->sem = FFSEM_NULL;
+		if (NULL == (q->sq = ffrq_alloc(ahd_conf->aconf.server.max_connections * workers_per_queue))) {
+			return -1;
+		}
+		if (!ahd_conf->aconf.server.polling_mode
+			&& FFSEM_NULL == (q->sem = ffsem_open(NULL, 0, 0))) {
+			return -1;
+		}
 	}
+
 	if (NULL == ffvec_allocT(&boss->kcq_workers, ahd_conf->kcall_workers, ffthread)) {
 		return -1;
 	}
@@ -21,11 +50,15 @@ void kcq_destroy()
 {
 	FFINT_WRITEONCE(boss->kcq_stop, 1);
 	ffthread *it;
+	struct kcq_queue *q;
 
-	if (boss->kcq_sem != FFSEM_NULL) {
+	if (!ahd_conf->aconf.server.polling_mode) {
 		dbglog("stopping kcall workers");
+		uint i = 0;
 		FFSLICE_WALK(&boss->kcq_workers, it) {
-			ffsem_post(boss->kcq_sem);
+			q = ffslice_itemT(&boss->kcq_queues, i++ % boss->kcq_queues.len, struct kcq_queue);
+			if (q->sem != FFSEM_NULL)
+				ffsem_post(q->sem);
 		}
 	}
 
@@ -34,19 +67,73 @@ void kcq_destroy()
 			ffthread_join(*it, -1, NULL);
 	}
 
-	if (boss->kcq_sem != FFSEM_NULL)
-		ffsem_close(boss->kcq_sem);
-	ffrq_free(boss->kcq_sq);
+	FFSLICE_WALK(&boss->kcq_queues, q) {
+		if (q->sem != FFSEM_NULL)
+			ffsem_close(q->sem);
+		ffrq_free(q->sq);
+	}
+	ffvec_free(&boss->kcq_queues);
 	ffvec_free(&boss->kcq_workers);
+	ffrq_free(boss->kcq_tasks);
+}
+
+static ffuint64 kcq_now_usec()
+{
+	fftime t = fftime_monotonic();
+	return fftime_to_usec(&t);
+}
+
+/** Adaptive polling: keep polling while new requests are being signalled
+until_usec: [in/out] polling deadline
+Return 1 if the worker should continue polling */
+static int kcq_poll(struct kcq_queue *q, ffuint64 *until_usec)
+{
+	ffuint64 now = kcq_now_usec();
+	if (0 == ffsem_wait(q->sem, 0))
+		*until_usec = now + ahd_conf->aconf.server.polling_usec;
+	return (now < *until_usec);
+}
+
+/** Process the requests from other queues */
+static void kcq_steal(uint iq)
+{
+	uint n = boss->kcq_queues.len;
+	for (uint i = 1;  i != n;  i++) {
+		struct kcq_queue *q = ffslice_itemT(&boss->kcq_queues, (iq + i) % n, struct kcq_queue);
+		ffkcallq_process_sq(q->sq);
+	}
+}
+
+/** Execute the blocking tasks */
+static void kcq_tasks_process()
+{
+	void *ptr;
+	while (0 == ffrq_fetch(boss->kcq_tasks, &ptr, NULL)) {
+		struct alphahttpd_task *t = ptr;
+		t->run(t->param);
+		t->complete(t);
+	}
 }
 
 static int FFTHREAD_PROCCALL kcq_worker(void *param)
 {
-	dbglog("entering kcall loop");
+	uint iq = (ffsize)param;
+	struct kcq_queue *q = ffslice_itemT(&boss->kcq_queues, iq, struct kcq_queue);
+	dbglog("entering kcall loop: queue #%u", iq);
+	uint poll_usec = ahd_conf->aconf.server.polling_usec;
+	ffuint64 until_usec = 0;
 	while (!FFINT_READONCE(boss->kcq_stop)) {
-		ffkcallq_process_sq(boss->kcq_sq);
-		if (!ahd_conf->aconf.server.polling_mode)
-			ffsem_wait(boss->kcq_sem, -1);
+		ffkcallq_process_sq(q->sq);
+		kcq_steal(iq);
+		kcq_tasks_process();
+		if (ahd_conf->aconf.server.polling_mode)
+			continue;
+
+		if (poll_usec != 0 && kcq_poll(q, &until_usec))
+			continue;
+		ffsem_wait(q->sem, -1);
+		if (poll_usec != 0)
+			until_usec = kcq_now_usec() + poll_usec;
 	}
 	dbglog("left kcall loop");
 	return 0;
@@ -55,8 +142,10 @@ static int FFTHREAD_PROCCALL kcq_worker(void *param)
 int kcq_start()
 {
 	ffthread *it;
+	uint i = 0;
 	FFSLICE_WALK(&boss->kcq_workers, it) {
-		if (FFTHREAD_NULL == (*it = ffthread_create(kcq_worker, boss, 0))) {
+		void *param = (void*)(ffsize)(i++ % boss->kcq_queues.len);
+		if (FFTHREAD_NULL == (*it = ffthread_create(kcq_worker, param, 0))) {
 			syserrlog("thread create");
 			return -1;
 		}
@@ -64,8 +153,25 @@ int kcq_start()
 	return 0;
 }
 
+/** Assign a submission queue to HTTP worker */
 void kcq_set(void *opaque, struct ffkcallqueue *kcq)
 {
-	kcq->sq = boss->kcq_sq;
-	kcq->sem = boss->kcq_sem;
+	uint i = __atomic_fetch_add(&boss->kcq_next, 1, __ATOMIC_RELAXED) % boss->kcq_queues.len;
+	struct kcq_queue *q = ffslice_itemT(&boss->kcq_queues, i, struct kcq_queue);
+	kcq->sq = q->sq;
+	kcq->sem = q->sem;
+}
+
+/** Put the task into queue and wake up a kcall thread */
+int kcq_task_post(void *opaque, struct alphahttpd_task *t)
+{
+	if (0 != ffrq_add(boss->kcq_tasks, t, NULL))
+		return -1;
+
+	if (!ahd_conf->aconf.server.polling_mode) {
+		uint i = __atomic_fetch_add(&boss->kcq_task_next, 1, __ATOMIC_RELAXED) % boss->kcq_queues.len;
+		struct kcq_queue *q = ffslice_itemT(&boss->kcq_queues, i, struct kcq_queue);
+		ffsem_post(q->sem);
+	}
+	return 0;
 }
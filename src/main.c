@@ -8,6 +8,7 @@ typedef unsigned int uint;
 #include <cmd.h>
 #include <FFOS/signal.h>
 #include <FFOS/thread.h>
+#include <FFOS/perf.h>
 #include <FFOS/ffos-extern.h>
 #ifdef FF_UNIX
 #include <sys/resource.h>
@@ -24,10 +25,12 @@ struct ahd_boss {
 	ffvec workers; // struct worker[]
 	uint conn_id;
 
-	ffringqueue *kcq_sq;
-	ffsem kcq_sem;
+	ffvec kcq_queues; // struct kcq_queue[]
+	uint kcq_next; // the queue for the next HTTP worker
 	ffvec kcq_workers; // ffthread[]
 	uint kcq_stop;
+	ffringqueue *kcq_tasks; // struct alphahttpd_task*[] shared by all kcall threads
+	uint kcq_task_next; // the queue to signal about the next task
 
 	uint stdout_color;
 };
@@ -47,6 +50,7 @@ do { \
 
 #include <log.h>
 #include <kcq.h>
+#include <util/http1-simd.h>
 
 static int FFTHREAD_PROCCALL wrk_thread(struct worker *w)
 {
@@ -151,6 +155,12 @@ static void http_mods_init(struct alphahttpd_conf *aconf)
 	}
 	ffvec_free(&v);
 	ffmem_free(fn);
+
+	if (0 != alphahttpd_filter_file_ocache_init(aconf, ahd_conf->workers_n))
+		syserrlog("in-memory cache init");
+
+	http1_simd_init();
+	dbglog("HTTP parser: %s", http1_simd_name());
 }
 
 static void aconf_setup(struct ahd_conf *conf)
@@ -159,6 +169,7 @@ static void aconf_setup(struct ahd_conf *conf)
 	ac->log = ahd_log;
 	ac->logv = ahd_logv;
 	ac->kcq_set = kcq_set;
+	ac->task_post = kcq_task_post;
 	ac->filters = (const struct alphahttpd_filter**)ah_filters;
 	ac->server.conn_id_counter = &boss->conn_id;
 	http_mods_init(ac);
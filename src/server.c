@@ -2,12 +2,24 @@
 2022, Simon Zolin */
 
 #include <http/client.h>
+#include <http/fcache.h>
+#include <http/dcache.h>
 #include <util/ipaddr.h>
+#include <util/bufpool.h>
+#include <util/qsbr.h>
+#include <util/tinylfu.h>
+#include <util/http1-simd.h>
 #include <FFOS/queue.h>
 #include <FFOS/socket.h>
 #include <FFOS/timer.h>
 #include <FFOS/perf.h>
 #include <FFOS/thread.h>
+#ifdef FF_LINUX
+#include <util/uring.h>
+#include <sys/sysmacros.h>
+#endif
+
+HTTP1_SIMD_DEFINE
 
 struct alphahttpd {
 	struct alphahttpd_conf conf;
@@ -18,9 +30,12 @@ struct alphahttpd {
 	ffkq kq;
 	ffkq_event *kevents;
 	struct ahd_kev *connections;
+	alphahttpd_client *clients; // client objects: clients[i] is used with connections[i]
 	uint connections_n;
 	struct ahd_kev *reusable_connections_lifo;
 	uint iconn, conn_num;
+	uint accept_n; // connections accepted during this loop iteration
+	uint accept_more; // accept budget is exhausted but there may be more pending connections
 	ahd_timer tmr_fdlimit;
 	struct ahd_kev post_kev;
 	ffkq_postevent kqpost;
@@ -29,25 +44,61 @@ struct alphahttpd {
 
 	struct ffkcallqueue kcq;
 	struct ahd_kev kcq_kev;
+	ffringqueue *task_cq; // completed tasks
+
+	struct bufpool bufpool;
+	int qsbr_slot; // -1: shared data isn't used
+	struct tinylfu ocache_freq;
+
+	// worker load measurement (fs.compress)
+	fftime busy_start;
+	ffuint64 busy_usec, load_start_usec;
+
+	ffuint64 poll_until_usec; // adaptive polling deadline
 
 	fftimer timer;
-	fftimerqueue timer_q;
+	struct twheel timer_wheel;
 	struct ahd_kev timer_kev;
-	uint timer_now_ms;
+	ffuint64 timer_now_ms;
 	fftime date_now;
 	char date_buf[FFS_LEN("0000-00-00T00:00:00.000")+1];
+
+#ifdef FF_LINUX
+	struct uring uring;
+	struct ahd_kev uring_kq_kev;
+	struct __kernel_timespec uring_timer_ts;
+	ffsockaddr uring_peer;
+	ffuint uring_peer_len;
+	char *uring_bufs; // region of buffers registered for file I/O
+	void **uring_bufs_free; // free buffers (LIFO)
+	ffuint uring_bufs_nfree;
+	int *uring_files_free; // free slots in the registered files table (LIFO)
+	ffuint uring_files_nfree;
+#endif
 };
 
-extern void cl_start(struct ahd_kev *kev, ffsock csock, const ffsockaddr *peer, uint conn_id, alphahttpd *srv, struct ahd_server *si);
+extern void cl_start(alphahttpd_client *c, struct ahd_kev *kev, ffsock csock, const ffsockaddr *peer, uint conn_id, alphahttpd *srv, struct ahd_server *si);
 extern void cl_destroy(alphahttpd_client *c);
 
 static void sv_accept(alphahttpd *s);
 static int sv_timer_start(alphahttpd *s);
 static int sv_kq_attach(alphahttpd *s, ffsock sk, struct ahd_kev *kev, void *obj);
-static void sv_timer(alphahttpd *s, ahd_timer *tmr, int interval_msec, fftimerqueue_func func, void *param);
+static void sv_timer(alphahttpd *s, ahd_timer *tmr, int interval_msec, twheel_func func, void *param);
 fftime sv_date(alphahttpd *s, ffstr *dts);
+static void* sv_buf_alloc(alphahttpd *s, ffvec *buf, ffsize size);
+static void sv_buf_free(alphahttpd *s, ffvec *buf);
 static int sv_worker(alphahttpd *s);
 static void kcq_onsignal(alphahttpd *s);
+static int sv_task_run(alphahttpd *s, struct ahd_kev *kev, void (*func)(void *param), void *param);
+static void sv_tasks_process(alphahttpd *s);
+#ifdef FF_LINUX
+static int sv_uring_init(alphahttpd *s);
+static int sv_uring_worker(alphahttpd *s);
+static ffsock sv_uring_accept(alphahttpd *s, ffsockaddr *peer);
+static int sv_uring_recv(alphahttpd *s, struct ahd_kev *kev, ffsock sk, void *buf, ffsize cap);
+static int sv_uring_sendv(alphahttpd *s, struct ahd_kev *kev, ffsock sk, ffiovec *iov, uint iov_n);
+static int sv_uring_cancel(alphahttpd *s, struct ahd_kev *kev);
+#endif
 
 #define sv_sysfatallog(s, ...) \
 	s->conf.log(s->conf.opaque, ALPHAHTTPD_LOG_SYSFATAL, NULL, __VA_ARGS__)
@@ -58,6 +109,9 @@ static void kcq_onsignal(alphahttpd *s);
 #define sv_errlog(s, ...) \
 	s->conf.log(s->conf.opaque, ALPHAHTTPD_LOG_ERR, NULL, __VA_ARGS__)
 
+#define sv_syswarnlog(s, ...) \
+	s->conf.log(s->conf.opaque, ALPHAHTTPD_LOG_SYSWARN, NULL, __VA_ARGS__)
+
 #define sv_warnlog(s, ...) \
 	s->conf.log(s->conf.opaque, ALPHAHTTPD_LOG_WARN, NULL, __VA_ARGS__)
 
@@ -89,6 +143,9 @@ alphahttpd* alphahttpd_new()
 	s->kq = FFKQ_NULL;
 	s->lsock = FFSOCK_NULL;
 	s->timer = FFTIMER_NULL;
+#ifdef FF_LINUX
+	s->uring.fd = -1;
+#endif
 	return s;
 }
 
@@ -110,17 +167,31 @@ static void sv_conf_init(struct alphahttpd_conf *conf)
 	conf->server.listen_addresses = a;
 	conf->server.events_num = 1024;
 	conf->server.fdlimit_timeout_sec = 10;
+	conf->server.buffer_pool_max = 8*1024*1024;
 	conf->server.timer_interval_msec = 250;
 	conf->server.max_connections = 10000;
+	conf->server.accept_budget = 64;
 	conf->server.conn_id_counter = &conf->server._conn_id_counter_default;
 
 	conf->max_keep_alive_reqs = 100;
 
 	conf->receive.buf_size = 4096;
+	conf->receive.buf_max_size = 64*1024 - 1;
 	conf->receive.timeout_sec = 65;
 
 	ffstr_setz(&conf->fs.index_filename, "index.html");
 	conf->fs.file_buf_size = 16*1024;
+	conf->fs.fd_cache_max = 256;
+	conf->fs.fd_cache_ttl_sec = 10;
+	conf->fs.ocache_max_size = 16*1024*1024;
+	conf->fs.ocache_file_max_size = 4096;
+	conf->fs.mmap_min_size = 16*1024;
+	conf->fs.mmap_max_size = 1*1024*1024;
+	conf->fs.compress_min_size = 256;
+	conf->fs.compress_cache_file_max_size = 1*1024*1024;
+	conf->fs.compress_cache_max_size = 16*1024*1024;
+	conf->fs.dir_cache_max = 64;
+	conf->fs.dir_cache_max_size = 4*1024*1024;
 
 	conf->response.buf_size = 4096;
 	ffstr_setz(&conf->response.server_name, "alphahttpd");
@@ -142,6 +213,16 @@ int alphahttpd_conf(alphahttpd *s, struct alphahttpd_conf *conf)
 	s->si.timer = sv_timer;
 	s->si.date = sv_date;
 	s->si.cl_destroy = cl_destroy;
+	s->si.buf_alloc = sv_buf_alloc;
+	s->si.buf_free = sv_buf_free;
+	s->si.task_run = sv_task_run;
+#ifdef FF_LINUX
+	s->si.recv = sv_uring_recv;
+	s->si.sendv = sv_uring_sendv;
+	s->si.io_cancel = sv_uring_cancel;
+#else
+	s->conf.server.io_uring = 0;
+#endif
 	return 0;
 }
 
@@ -207,7 +288,8 @@ static int kcq_init(alphahttpd *s)
 	if (s->conf.kcq_set == NULL) return 0;
 
 	s->conf.kcq_set(s->conf.opaque, &s->kcq);
-	if (NULL == (s->kcq.cq = ffrq_alloc(s->connections_n))) {
+	if (NULL == (s->kcq.cq = ffrq_alloc(s->connections_n))
+		|| NULL == (s->task_cq = ffrq_alloc(s->connections_n))) {
 		sv_sysfatallog(s, "ffrq_alloc");
 		return -1;
 	}
@@ -227,6 +309,33 @@ static int kcq_init(alphahttpd *s)
 	return 0;
 }
 
+/** Create the worker's caches enabled in configuration */
+static int sv_caches_init(alphahttpd *s)
+{
+	const struct alphahttpd_conf *conf = &s->conf;
+
+	if (conf->fs.fd_cache_max != 0
+		&& NULL == (s->si.fcache = fcache_new(conf->fs.fd_cache_max, conf->fs.fd_cache_ttl_sec
+			, conf->fs.compress_cache_max_size, s->si.file_unregister, s)))
+		goto nomem;
+
+	if (conf->fs.dir_cache_max != 0
+		&& NULL == (s->si.dcache = dcache_new(conf->fs.dir_cache_max, conf->fs.dir_cache_max_size
+			, conf->fs.fd_cache_ttl_sec)))
+		goto nomem;
+
+	if (conf->fs.ocache != NULL) {
+		if (0 != tinylfu_init(&s->ocache_freq, conf->fs.ocache_max_size / 256))
+			goto nomem;
+		s->si.ocache_freq = &s->ocache_freq;
+	}
+	return 0;
+
+nomem:
+	sv_sysfatallog(s, "no memory");
+	return -1;
+}
+
 int alphahttpd_run(alphahttpd *s)
 {
 	fftime_now(&s->date_now);
@@ -236,12 +345,25 @@ int alphahttpd_run(alphahttpd *s)
 
 	s->connections_n = s->conf.server.max_connections;
 	s->connections = (void*)ffmem_alloc(s->connections_n * sizeof(struct ahd_kev));
+	// Memory pages are touched only when the slot is used for the first time,
+	//  and then they are reused for the next clients
+	s->clients = (void*)ffmem_alloc(s->connections_n * sizeof(alphahttpd_client));
 	s->kevents = (void*)ffmem_alloc(s->conf.server.events_num * sizeof(ffkq_event));
-	if (s->connections == NULL || s->kevents == NULL) {
+	if (s->connections == NULL || s->clients == NULL || s->kevents == NULL) {
 		sv_sysfatallog(s, "no memory");
 		return -1;
 	}
 	ffmem_zero(s->connections, s->connections_n * sizeof(struct ahd_kev));
+	bufpool_init(&s->bufpool, s->conf.server.buffer_pool_max);
+
+	s->qsbr_slot = -1;
+	if (s->conf.server.qsbr != NULL) {
+		if (0 > (s->qsbr_slot = qsbr_register(s->conf.server.qsbr))) {
+			sv_errlog(s, "qsbr_register: too many workers");
+			return -1;
+		}
+		qsbr_online(s->conf.server.qsbr, s->qsbr_slot);
+	}
 
 	if (FFKQ_NULL == (s->kq = ffkq_create())) {
 		sv_sysfatallog(s, "ffkq_create");
@@ -255,9 +377,16 @@ int alphahttpd_run(alphahttpd *s)
 	if (0 != lsock_prepare(s))
 		return -1;
 
+#ifdef FF_LINUX
+	if (s->conf.server.io_uring
+		&& 0 != sv_uring_init(s))
+		return -1;
+#endif
+
 	s->lsock_kev.rhandler = (ahd_kev_func)sv_accept;
 	s->lsock_kev.obj = s;
-	if (0 != ffkq_attach_socket(s->kq, s->lsock, &s->lsock_kev, FFKQ_READ)) {
+	if (!s->conf.server.io_uring
+		&& 0 != ffkq_attach_socket(s->kq, s->lsock, &s->lsock_kev, FFKQ_READ)) {
 		sv_sysfatallog(s, "ffkq_attach_socket");
 		return -1;
 	}
@@ -268,6 +397,9 @@ int alphahttpd_run(alphahttpd *s)
 	if (0 != kcq_init(s))
 		return -1;
 
+	if (0 != sv_caches_init(s))
+		return -1;
+
 	sv_accept(s);
 	sv_worker(s);
 	return 0;
@@ -277,12 +409,31 @@ void alphahttpd_free(alphahttpd *s)
 {
 	if (s == NULL) return;
 
+	if (s->si.read_nowait_hits + s->si.read_nowait_misses != 0)
+		sv_verblog(s, "file reads from page cache: %U, asynchronous: %U"
+			, s->si.read_nowait_hits, s->si.read_nowait_misses);
+
 	ffrq_free(s->kcq.cq);
+	ffrq_free(s->task_cq);
+	// the registered files are removed from io_uring table while the ring is still open
+	fcache_free(s->si.fcache);
+#ifdef FF_LINUX
+	uring_close(&s->uring);
+#endif
 	fftimer_close(s->timer, s->kq);
 	ffsock_close(s->lsock);
 	ffkq_close(s->kq);
 	ffmem_free(s->kevents);
 	ffmem_free(s->connections);
+	ffmem_free(s->clients);
+#ifdef FF_LINUX
+	ffmem_alignfree(s->uring_bufs);
+	ffmem_free(s->uring_bufs_free);
+	ffmem_free(s->uring_files_free);
+#endif
+	tinylfu_destroy(&s->ocache_freq);
+	dcache_free(s->si.dcache);
+	bufpool_destroy(&s->bufpool);
 	ffmem_free(s);
 }
 
@@ -290,19 +441,25 @@ static int sv_accept1(alphahttpd *s)
 {
 	if (s->conn_num == s->connections_n) {
 		sv_warnlog(s, "reached max worker connections limit %u", s->connections_n);
-		sv_timer(s, &s->tmr_fdlimit, -(int)s->conf.server.fdlimit_timeout_sec*1000, (fftimerqueue_func)sv_accept, s);
+		sv_timer(s, &s->tmr_fdlimit, -(int)s->conf.server.fdlimit_timeout_sec*1000, (twheel_func)sv_accept, s);
 		return -1;
 	}
 
 	ffsock csock;
 	ffsockaddr peer;
-	if (FFSOCK_NULL == (csock = ffsock_accept_async(s->lsock, &peer, FFSOCK_NONBLOCK, s->sock_family, NULL, &s->lsock_kev.rtask_accept))) {
+#ifdef FF_LINUX
+	if (s->conf.server.io_uring)
+		csock = sv_uring_accept(s, &peer);
+	else
+#endif
+		csock = ffsock_accept_async(s->lsock, &peer, FFSOCK_NONBLOCK, s->sock_family, NULL, &s->lsock_kev.rtask_accept);
+	if (FFSOCK_NULL == csock) {
 		if (fferr_last() == FFSOCK_EINPROGRESS)
 			return -1;
 
 		if (fferr_fdlimit(fferr_last())) {
 			sv_syserrlog(s, "ffsock_accept");
-			sv_timer(s, &s->tmr_fdlimit, -(int)s->conf.server.fdlimit_timeout_sec*1000, (fftimerqueue_func)sv_accept, s);
+			sv_timer(s, &s->tmr_fdlimit, -(int)s->conf.server.fdlimit_timeout_sec*1000, (twheel_func)sv_accept, s);
 			return -1;
 		}
 
@@ -327,58 +484,147 @@ static int sv_accept1(alphahttpd *s)
 	if (s->conf.kcq_set != NULL)
 		kev->kcall.q = &s->kcq;
 
-	cl_start(kev, csock, &peer, conn_id, s, &s->si);
+	cl_start(&s->clients[kev - s->connections], kev, csock, &peer, conn_id, s, &s->si);
 	return 0;
 }
 
-/** Accept a bunch of client connections */
+/** Accept a bunch of client connections.
+Stop when the per-iteration budget is exhausted: the next loop iteration continues accepting. */
 static void sv_accept(alphahttpd *s)
 {
+	s->accept_more = 0;
 	for (;;) {
+		if (s->accept_n == s->conf.server.accept_budget
+			&& s->accept_n != 0) {
+			sv_dbglog(s, "accept budget exhausted");
+			s->accept_more = 1;
+			break;
+		}
+
 		if (0 != sv_accept1(s))
 			break;
+		s->accept_n++;
+	}
+}
+
+/** Prepare for the next loop iteration: continue accepting connections if necessary */
+static void sv_accept_next(alphahttpd *s)
+{
+	s->accept_n = 0;
+	if (s->accept_more)
+		sv_accept(s);
+}
+
+/** Worker won't access shared data until sv_online() */
+static inline void sv_offline(alphahttpd *s)
+{
+	if (s->qsbr_slot >= 0)
+		qsbr_offline(s->conf.server.qsbr, s->qsbr_slot);
+}
+
+static inline void sv_online(alphahttpd *s)
+{
+	if (s->qsbr_slot >= 0)
+		qsbr_online(s->conf.server.qsbr, s->qsbr_slot);
+}
+
+/** Worker starts waiting for events */
+static inline void sv_wait_begin(alphahttpd *s)
+{
+	sv_offline(s);
+}
+
+static inline void sv_wait_end(alphahttpd *s)
+{
+	sv_online(s);
+	if (s->conf.fs.compress)
+		s->busy_start = fftime_monotonic();
+}
+
+/** Account the time spent handling events for worker load measurement.
+The iterations without events (polling) are idle time.
+active: events were processed during this iteration */
+static inline void sv_busy_end(alphahttpd *s, uint active)
+{
+	if (s->conf.fs.compress && active) {
+		fftime t = fftime_monotonic();
+		fftime_sub(&t, &s->busy_start);
+		s->busy_usec += fftime_to_usec(&t);
+	}
+}
+
+/** Adaptive polling: check whether to poll during the next loop iteration
+active: events were processed during this iteration
+Return 1 if the worker shouldn't block */
+static int sv_poll_next(alphahttpd *s, uint active)
+{
+	fftime t = fftime_monotonic();
+	ffuint64 now = fftime_to_usec(&t);
+	if (active)
+		s->poll_until_usec = now + s->conf.server.polling_usec;
+	return (now < s->poll_until_usec);
+}
+
+/** Call handlers for the received kq events */
+static void sv_kq_process(alphahttpd *s, int r)
+{
+	for (int i = 0;  i < r;  i++) {
+		ffkq_event *ev = &s->kevents[i];
+		void *d = ffkq_event_data(ev);
+		struct ahd_kev *c = (void*)((ffsize)d & ~1);
+
+		if (((ffsize)d & 1) != c->side)
+			continue;
+
+		int flags = ffkq_event_flags(ev);
+		// ffkq_task_event_assign();
+
+#ifdef FF_WIN
+		flags = FFKQ_READ;
+		if (ev->lpOverlapped == &c->wtask.overlapped)
+			flags = FFKQ_WRITE;
+#endif
+
+		sv_extralog(s, "%p #%L f:%xu r:%d w:%d"
+			, c, c - s->connections, flags, c->rtask.active, c->wtask.active);
+
+		if ((flags & FFKQ_READ) && c->rtask.active)
+			c->rhandler(c->obj);
+		if ((flags & FFKQ_WRITE) && c->wtask.active)
+			c->whandler(c->obj);
 	}
 }
 
 static int sv_worker(alphahttpd *s)
 {
+#ifdef FF_LINUX
+	if (s->conf.server.io_uring)
+		return sv_uring_worker(s);
+#endif
+
 	sv_dbglog(s, "entering kq loop");
 	ffkq_time t;
 	ffkq_time_set(&t, -1);
 	if (s->conf.server.polling_mode)
 		ffkq_time_set(&t, 0);
+	uint adaptive = (!s->conf.server.polling_mode && s->conf.server.polling_usec != 0);
+	uint poll = 0;
 
 	while (!FFINT_READONCE(s->worker_stop)) {
-		int r = ffkq_wait(s->kq, s->kevents, s->conf.server.events_num, t);
+		sv_accept_next(s);
 
-		for (int i = 0;  i < r;  i++) {
-			ffkq_event *ev = &s->kevents[i];
-			void *d = ffkq_event_data(ev);
-			struct ahd_kev *c = (void*)((ffsize)d & ~1);
+		ffkq_time tw = t;
+		if (s->accept_more || poll)
+			ffkq_time_set(&tw, 0);
+		sv_wait_begin(s);
+		int r = ffkq_wait(s->kq, s->kevents, s->conf.server.events_num, tw);
+		sv_wait_end(s);
 
-			if (((ffsize)d & 1) != c->side)
-				continue;
-
-			int flags = ffkq_event_flags(ev);
-			// ffkq_task_event_assign();
-
-#ifdef FF_WIN
-			flags = FFKQ_READ;
-			if (ev->lpOverlapped == &c->wtask.overlapped)
-				flags = FFKQ_WRITE;
-#endif
-
-			sv_extralog(s, "%p #%L f:%xu r:%d w:%d"
-				, c, c - s->connections, flags, c->rtask.active, c->wtask.active);
-
-			if ((flags & FFKQ_READ) && c->rtask.active)
-				c->rhandler(c->obj);
-			if ((flags & FFKQ_WRITE) && c->wtask.active)
-				c->whandler(c->obj);
-		}
+		sv_kq_process(s, r);
 
 		if (r < 0 && fferr_last() != EINTR) {
 			sv_sysfatallog(s, "ffkq_wait");
+			sv_offline(s);
 			return -1;
 		}
 
@@ -386,9 +632,16 @@ static int sv_worker(alphahttpd *s)
 			sv_extralog(s, "processed %u events", r);
 		}
 
-		if (s->conf.kcq_set != NULL)
+		if (s->conf.kcq_set != NULL) {
 			ffkcallq_process_cq(s->kcq.cq);
+			sv_tasks_process(s);
+		}
+
+		sv_busy_end(s, (r > 0));
+		if (adaptive)
+			poll = sv_poll_next(s, (r > 0));
 	}
+	sv_offline(s);
 	sv_dbglog(s, "leaving kq loop");
 	return 0;
 }
@@ -400,6 +653,11 @@ void sv_conn_fin(alphahttpd *s, struct ahd_kev *kev)
 	kev->side = !kev->side;
 	kev->obj = NULL;
 
+	ffmem_zero_obj(&kev->urtask_r);
+	ffmem_zero_obj(&kev->urtask_w);
+	ffmem_zero_obj(&kev->urtask_f);
+	kev->task_pending = 0;
+
 	kev->next_kev = s->reusable_connections_lifo;
 	s->reusable_connections_lifo = kev;
 
@@ -412,6 +670,8 @@ void sv_conn_fin(alphahttpd *s, struct ahd_kev *kev)
 static int sv_kq_attach(alphahttpd *s, ffsock sk, struct ahd_kev *kev, void *obj)
 {
 	kev->obj = obj;
+	if (s->conf.server.io_uring)
+		return 0;
 	if (0 != ffkq_attach_socket(s->kq, sk, (void*)((ffsize)kev | kev->side), FFKQ_READWRITE)) {
 		sv_syserrlog(s, "ffkq_attach_socket");
 		return -1;
@@ -442,21 +702,83 @@ fftime sv_date(alphahttpd *s, ffstr *dts)
 	return t;
 }
 
-static void sv_ontimer(alphahttpd *s)
+/** Update worker load value once per second: the share of time spent handling events */
+static void sv_load_update(alphahttpd *s, fftime now)
+{
+	ffuint64 now_usec = fftime_to_usec(&now);
+	ffuint64 elapsed = now_usec - s->load_start_usec;
+	if (elapsed < 1000000)
+		return;
+
+	if (s->load_start_usec != 0) {
+		ffuint64 busy = ffmin64(s->busy_usec, elapsed);
+		s->si.load = busy * 100 / elapsed;
+	}
+	s->load_start_usec = now_usec;
+	s->busy_usec = 0;
+}
+
+static void sv_timer_tick(alphahttpd *s)
 {
 	fftime_now(&s->date_now);
 	s->date_now.sec += FFTIME_1970_SECONDS;
 
 	fftime t = fftime_monotonic();
-	s->timer_now_ms = t.sec*1000 + t.nsec/1000000;
+	s->timer_now_ms = (ffuint64)t.sec*1000 + t.nsec/1000000;
 	s->date_buf[0] = '\0';
 
-	fftimerqueue_process(&s->timer_q, s->timer_now_ms);
+	if (s->conf.fs.compress)
+		sv_load_update(s, t);
+
+	twheel_process(&s->timer_wheel, s->timer_now_ms);
+}
+
+/** Get buffer from the worker's pool */
+static void* sv_buf_alloc(alphahttpd *s, ffvec *buf, ffsize size)
+{
+	ffsize cap;
+	if (NULL == (buf->ptr = bufpool_alloc(&s->bufpool, size, &cap)))
+		return NULL;
+	buf->len = 0;
+	buf->cap = cap;
+	return buf->ptr;
+}
+
+#ifdef FF_LINUX
+static int sv_uring_buf_free(alphahttpd *s, void *ptr);
+#endif
+
+/** Return buffer to the worker's pool */
+static void sv_buf_free(alphahttpd *s, ffvec *buf)
+{
+#ifdef FF_LINUX
+	if (0 == sv_uring_buf_free(s, buf->ptr)) {
+		ffvec_null(buf);
+		return;
+	}
+#endif
+	if (buf->cap != 0)
+		bufpool_free(&s->bufpool, buf->ptr, buf->cap);
+	ffvec_null(buf);
+}
+
+static void sv_ontimer(alphahttpd *s)
+{
+	sv_timer_tick(s);
 	fftimer_consume(s->timer);
 }
 
+#ifdef FF_LINUX
+static int sv_uring_timer_start(alphahttpd *s);
+#endif
+
 static int sv_timer_start(alphahttpd *s)
 {
+#ifdef FF_LINUX
+	if (s->conf.server.io_uring)
+		return sv_uring_timer_start(s);
+#endif
+
 	if (FFTIMER_NULL == (s->timer = fftimer_create(0))) {
 		sv_sysfatallog(s, "fftimer_create");
 		return -1;
@@ -468,25 +790,625 @@ static int sv_timer_start(alphahttpd *s)
 		sv_sysfatallog(s, "fftimer_start");
 		return -1;
 	}
-	fftimerqueue_init(&s->timer_q);
+	twheel_init(&s->timer_wheel, s->conf.server.timer_interval_msec);
 	sv_ontimer(s);
 	return 0;
 }
 
 /** Add/restart/remove periodic/one-shot timer */
-static void sv_timer(alphahttpd *s, ahd_timer *tmr, int interval_msec, fftimerqueue_func func, void *param)
+static void sv_timer(alphahttpd *s, ahd_timer *tmr, int interval_msec, twheel_func func, void *param)
 {
 	if (interval_msec == 0) {
-		if (fftimerqueue_remove(&s->timer_q, tmr))
+		if (twheel_remove(&s->timer_wheel, tmr))
 			sv_dbglog(s, "timer remove: %p", tmr);
 		return;
 	}
 
-	fftimerqueue_add(&s->timer_q, tmr, s->timer_now_ms, interval_msec, func, param);
+	twheel_add(&s->timer_wheel, tmr, s->timer_now_ms, interval_msec, func, param);
 	sv_dbglog(s, "timer add: %p %d", tmr, interval_msec);
 }
 
 static void kcq_onsignal(alphahttpd *s)
 {
 	ffkcallq_process_cq(s->kcq.cq);
+	sv_tasks_process(s);
+}
+
+/** The task is complete (called by kcall thread): pass it to the worker */
+static void sv_task_complete(struct alphahttpd_task *t)
+{
+	alphahttpd *s = t->complete_param;
+	int r = ffrq_add(s->task_cq, t, NULL);
+	FF_ASSERT(r == 0); // there can't be more tasks than connections
+	(void)r;
+	if (s->kcq.kqpost != FFKQ_NULL)
+		ffkq_post(s->kcq.kqpost, s->kcq.kqpost_data);
+}
+
+static int sv_task_run(alphahttpd *s, struct ahd_kev *kev, void (*func)(void *param), void *param)
+{
+	struct alphahttpd_task *t = &kev->task;
+	t->run = func;
+	t->param = param;
+	t->complete = sv_task_complete;
+	t->complete_param = s;
+	if (s->conf.task_post == NULL
+		|| s->task_cq == NULL
+		|| 0 != s->conf.task_post(s->conf.opaque, t)) {
+		func(param);
+		return 0;
+	}
+	kev->task_pending = 1;
+	return 1;
+}
+
+/** Call handlers for the completed tasks */
+static void sv_tasks_process(alphahttpd *s)
+{
+	void *ptr;
+	while (0 == ffrq_fetch_sr(s->task_cq, &ptr, NULL)) {
+		struct ahd_kev *kev = FF_STRUCTPTR(struct ahd_kev, task, ptr);
+		kev->task_pending = 0;
+		kev->rhandler(kev->obj);
+	}
+}
+
+#ifdef FF_LINUX
+
+/* io_uring operation's user data: struct ahd_kev* | side | UR_WRITE | UR_FILE */
+#define UR_WRITE  2
+#define UR_FILE  4
+#define UR_MASK  7ULL
+
+static inline ffuint64 sv_uring_udata(struct ahd_kev *kev, uint flags)
+{
+	return (ffsize)kev | kev->side | flags;
+}
+
+/** Get a free SQE; flush the SQ ring if it's full */
+static struct io_uring_sqe* sv_uring_sqe(alphahttpd *s)
+{
+	struct io_uring_sqe *sqe;
+	if (NULL == (sqe = uring_sqe(&s->uring))) {
+		if (0 > uring_enter(&s->uring, 0))
+			sv_syserrlog(s, "io_uring_enter");
+		if (NULL == (sqe = uring_sqe(&s->uring))) {
+			sv_errlog(s, "io_uring: SQ ring is full");
+			fferr_set(EBUSY);
+		}
+	}
+	return sqe;
+}
+
+static void sv_uring_onkq(alphahttpd *s);
+
+/** Get notified via io_uring when there are kq events (timer, kcall or stop signals) */
+static int sv_uring_kq_arm(alphahttpd *s)
+{
+	struct io_uring_sqe *sqe;
+	if (NULL == (sqe = sv_uring_sqe(s)))
+		return -1;
+	uring_prep_poll(sqe, s->kq, POLLIN, sv_uring_udata(&s->uring_kq_kev, 0));
+	return 0;
+}
+
+static void sv_uring_file_init(alphahttpd *s);
+
+static int sv_uring_init(alphahttpd *s)
+{
+	if (0 != uring_init(&s->uring, s->conf.server.events_num)) {
+		sv_syswarnlog(s, "io_uring_setup: falling back to kq");
+		s->conf.server.io_uring = 0;
+		return 0;
+	}
+
+	s->uring_kq_kev.rhandler = (ahd_kev_func)sv_uring_onkq;
+	s->uring_kq_kev.obj = s;
+	if (0 != sv_uring_kq_arm(s))
+		return -1;
+
+	sv_uring_file_init(s);
+	sv_dbglog(s, "using io_uring");
+	return 0;
+}
+
+static void sv_uring_onkq(alphahttpd *s)
+{
+	s->uring_kq_kev.urtask_r.done = 0;
+	ffkq_time t;
+	ffkq_time_set(&t, 0);
+	int r = ffkq_wait(s->kq, s->kevents, s->conf.server.events_num, t);
+	sv_kq_process(s, r);
+	sv_uring_kq_arm(s);
 }
+
+static void sv_uring_ontimer(alphahttpd *s)
+{
+	s->timer_kev.urtask_r.done = 0;
+	sv_timer_tick(s);
+
+	struct io_uring_sqe *sqe;
+	if (NULL == (sqe = sv_uring_sqe(s)))
+		return;
+	uring_prep_timeout(sqe, &s->uring_timer_ts, sv_uring_udata(&s->timer_kev, 0));
+}
+
+static int sv_uring_timer_start(alphahttpd *s)
+{
+	uint ms = s->conf.server.timer_interval_msec;
+	s->uring_timer_ts.tv_sec = ms / 1000;
+	s->uring_timer_ts.tv_nsec = (ms % 1000) * 1000000;
+	s->timer_kev.rhandler = (ahd_kev_func)sv_uring_ontimer;
+	s->timer_kev.obj = s;
+	twheel_init(&s->timer_wheel, ms);
+	sv_uring_ontimer(s);
+	return 0;
+}
+
+/** Get the result of the completed operation */
+static int sv_urtask_result(struct ahd_urtask *t)
+{
+	t->done = 0;
+	if (t->result < 0) {
+		fferr_set(-t->result);
+		return -1;
+	}
+	return t->result;
+}
+
+/** Begin asynchronous operation or return the result of the completed one */
+static int sv_uring_op(alphahttpd *s, struct ahd_kev *kev, uint op, ffsock sk, const void *buf, ffsize n)
+{
+	uint w = (op == IORING_OP_WRITEV);
+	struct ahd_urtask *t = (w) ? &kev->urtask_w : &kev->urtask_r;
+	if (t->done)
+		return sv_urtask_result(t);
+
+	if (!t->pending) {
+		struct io_uring_sqe *sqe;
+		if (NULL == (sqe = sv_uring_sqe(s)))
+			return -1;
+		uring_prep_rw(sqe, op, sk, buf, n, 0, sv_uring_udata(kev, (w) ? UR_WRITE : 0));
+		t->pending = 1;
+		t->fd = sk;
+	}
+
+	fferr_set(FFSOCK_EINPROGRESS);
+	return -1;
+}
+
+static int sv_uring_recv(alphahttpd *s, struct ahd_kev *kev, ffsock sk, void *buf, ffsize cap)
+{
+	return sv_uring_op(s, kev, IORING_OP_RECV, sk, buf, ffmin(cap, 0x7fffffff));
+}
+
+static int sv_uring_sendv(alphahttpd *s, struct ahd_kev *kev, ffsock sk, ffiovec *iov, uint iov_n)
+{
+	return sv_uring_op(s, kev, IORING_OP_WRITEV, sk, iov, iov_n);
+}
+
+static ffsock sv_uring_accept(alphahttpd *s, ffsockaddr *peer)
+{
+	struct ahd_urtask *t = &s->lsock_kev.urtask_r;
+	if (t->done) {
+		ffsock csock = sv_urtask_result(t);
+		if (csock == FFSOCK_NULL)
+			return FFSOCK_NULL;
+		*peer = s->uring_peer;
+		peer->len = s->uring_peer_len;
+		return csock;
+	}
+	t->done = 0;
+
+	if (!t->pending) {
+		struct io_uring_sqe *sqe;
+		if (NULL == (sqe = sv_uring_sqe(s)))
+			return FFSOCK_NULL;
+		s->uring_peer_len = sizeof(s->uring_peer.ip6);
+		uring_prep_accept(sqe, s->lsock, &s->uring_peer.ip6, &s->uring_peer_len, SOCK_NONBLOCK, sv_uring_udata(&s->lsock_kev, 0));
+		t->pending = 1;
+		t->fd = s->lsock;
+	}
+
+	fferr_set(FFSOCK_EINPROGRESS);
+	return FFSOCK_NULL;
+}
+
+/* File I/O via io_uring.
+The operations complete in the worker's event loop and call kev->rhandler().
+READ_FIXED is used for the buffers from the region registered at startup,
+ and the descriptors of the cached files are registered as fixed files.
+If kernel doesn't support these operations, ahd_server.file_*() are not set
+ and the client falls back to kcall thread pool. */
+
+#define UR_BUFS  64
+
+static fffd sv_uring_file_open(alphahttpd *s, struct ahd_kev *kev, const char *name, uint flags);
+static int sv_uring_file_info(alphahttpd *s, struct ahd_kev *kev, fffd f, void *statx, fffileinfo *fi);
+static ffssize sv_uring_file_read(alphahttpd *s, struct ahd_kev *kev, fffd f, int fixed, void *buf, ffsize cap, ffuint64 off);
+static ffssize sv_uring_file_write(alphahttpd *s, struct ahd_kev *kev, fffd f, const void *data, ffsize n);
+static void* sv_uring_buf_alloc(alphahttpd *s, ffvec *buf, ffsize size);
+static int sv_uring_file_register(alphahttpd *s, fffd f);
+static void sv_uring_file_unregister(alphahttpd *s, int fixed);
+
+/** Register the buffers for file I/O */
+static int sv_uring_bufs_init(alphahttpd *s)
+{
+	ffsize bufsize = s->conf.fs.file_buf_size;
+	if (NULL == (s->uring_bufs = ffmem_align(UR_BUFS * bufsize, 4096))
+		|| NULL == (s->uring_bufs_free = ffmem_alloc(UR_BUFS * sizeof(void*))))
+		return -1;
+
+	struct iovec iov = { s->uring_bufs, UR_BUFS * bufsize };
+	if (0 != uring_register(&s->uring, IORING_REGISTER_BUFFERS, &iov, 1)) {
+		sv_syswarnlog(s, "io_uring_register: buffers");
+		return -1;
+	}
+
+	for (uint i = 0;  i != UR_BUFS;  i++) {
+		s->uring_bufs_free[UR_BUFS - 1 - i] = s->uring_bufs + i * bufsize;
+	}
+	s->uring_bufs_nfree = UR_BUFS;
+	return 0;
+}
+
+/** Register the (empty) table of fixed files */
+static int sv_uring_files_init(alphahttpd *s)
+{
+	uint n = s->conf.fs.fd_cache_max;
+	int *fds;
+	if (n == 0
+		|| NULL == (fds = ffmem_alloc(n * sizeof(int))))
+		return -1;
+	for (uint i = 0;  i != n;  i++) {
+		fds[i] = -1;
+	}
+	int r = uring_register(&s->uring, IORING_REGISTER_FILES, fds, n);
+	ffmem_free(fds);
+	if (r != 0) {
+		sv_syswarnlog(s, "io_uring_register: files");
+		return -1;
+	}
+
+	if (NULL == (s->uring_files_free = ffmem_alloc(n * sizeof(int))))
+		return -1;
+	for (uint i = 0;  i != n;  i++) {
+		s->uring_files_free[i] = n - 1 - i;
+	}
+	s->uring_files_nfree = n;
+	return 0;
+}
+
+static void sv_uring_file_init(alphahttpd *s)
+{
+	static const ffbyte ops[] = {
+		IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ, IORING_OP_WRITE,
+	};
+	for (uint i = 0;  i != FF_COUNT(ops);  i++) {
+		if (!uring_op_supported(&s->uring, ops[i])) {
+			sv_dbglog(s, "io_uring: file I/O isn't supported: using kcall");
+			return;
+		}
+	}
+
+	s->si.file_open = sv_uring_file_open;
+	s->si.file_info = sv_uring_file_info;
+	s->si.file_read = sv_uring_file_read;
+	s->si.file_write = sv_uring_file_write;
+
+	if (0 == sv_uring_bufs_init(s)) {
+		s->si.fixed_buf_alloc = sv_uring_buf_alloc;
+	} else {
+		ffmem_alignfree(s->uring_bufs);
+		s->uring_bufs = NULL;
+	}
+
+	if (0 == sv_uring_files_init(s)) {
+		s->si.file_register = sv_uring_file_register;
+		s->si.file_unregister = sv_uring_file_unregister;
+	}
+}
+
+/** Get a registered buffer */
+static void* sv_uring_buf_alloc(alphahttpd *s, ffvec *buf, ffsize size)
+{
+	if (size > s->conf.fs.file_buf_size
+		|| s->uring_bufs_nfree == 0)
+		return NULL;
+	buf->ptr = s->uring_bufs_free[--s->uring_bufs_nfree];
+	buf->len = 0;
+	buf->cap = s->conf.fs.file_buf_size;
+	return buf->ptr;
+}
+
+static int sv_uring_buf_registered(alphahttpd *s, const void *ptr)
+{
+	return (s->uring_bufs != NULL
+		&& (char*)ptr >= s->uring_bufs
+		&& (char*)ptr < s->uring_bufs + UR_BUFS * s->conf.fs.file_buf_size);
+}
+
+/** Return the registered buffer
+Return 0 if the buffer belongs to the registered region */
+static int sv_uring_buf_free(alphahttpd *s, void *ptr)
+{
+	if (!sv_uring_buf_registered(s, ptr))
+		return -1;
+	s->uring_bufs_free[s->uring_bufs_nfree++] = ptr;
+	return 0;
+}
+
+static int sv_uring_files_update(alphahttpd *s, int fixed, int fd)
+{
+	struct io_uring_files_update up = {
+		.offset = fixed,
+		.fds = (ffsize)&fd,
+	};
+	return uring_register(&s->uring, IORING_REGISTER_FILES_UPDATE, &up, 1);
+}
+
+/** Put file descriptor into the registered files table
+Return index;  -1 on error */
+static int sv_uring_file_register(alphahttpd *s, fffd f)
+{
+	if (s->uring_files_nfree == 0)
+		return -1;
+	int i = s->uring_files_free[s->uring_files_nfree - 1];
+	if (1 != sv_uring_files_update(s, i, f)) {
+		sv_syswarnlog(s, "io_uring_register: files update");
+		return -1;
+	}
+	s->uring_files_nfree--;
+	return i;
+}
+
+static void sv_uring_file_unregister(alphahttpd *s, int fixed)
+{
+	if (1 != sv_uring_files_update(s, fixed, -1))
+		sv_syswarnlog(s, "io_uring_register: files update");
+	s->uring_files_free[s->uring_files_nfree++] = fixed;
+}
+
+/** Get the result of the completed file operation or a free SQE for the new one
+Return NULL if the result is ready */
+static struct io_uring_sqe* sv_uring_fop(alphahttpd *s, struct ahd_kev *kev, int *result)
+{
+	struct ahd_urtask *t = &kev->urtask_f;
+	if (t->done) {
+		*result = sv_urtask_result(t);
+		return NULL;
+	}
+
+	fferr_set(FFKCALL_EINPROGRESS);
+	*result = -1;
+	if (t->pending)
+		return NULL;
+
+	struct io_uring_sqe *sqe;
+	if (NULL == (sqe = sv_uring_sqe(s)))
+		return NULL;
+	t->pending = 1;
+	return sqe;
+}
+
+static fffd sv_uring_file_open(alphahttpd *s, struct ahd_kev *kev, const char *name, uint flags)
+{
+	int r;
+	struct io_uring_sqe *sqe;
+	if (NULL == (sqe = sv_uring_fop(s, kev, &r)))
+		return (r >= 0) ? r : FFFILE_NULL;
+
+	// O_NOATIME fails with EPERM if we are not the file owner
+	flags = (flags & ~O_NOATIME) | O_CLOEXEC;
+	uring_prep_openat(sqe, name, flags, sv_uring_udata(kev, UR_FILE));
+	return FFFILE_NULL;
+}
+
+static void sv_statx_stat(const struct statx *stx, struct stat *st)
+{
+	ffmem_zero_obj(st);
+	st->st_dev = makedev(stx->stx_dev_major, stx->stx_dev_minor);
+	st->st_ino = stx->stx_ino;
+	st->st_mode = stx->stx_mode;
+	st->st_nlink = stx->stx_nlink;
+	st->st_uid = stx->stx_uid;
+	st->st_gid = stx->stx_gid;
+	st->st_size = stx->stx_size;
+	st->st_blksize = stx->stx_blksize;
+	st->st_blocks = stx->stx_blocks;
+	st->st_atim.tv_sec = stx->stx_atime.tv_sec;
+	st->st_atim.tv_nsec = stx->stx_atime.tv_nsec;
+	st->st_mtim.tv_sec = stx->stx_mtime.tv_sec;
+	st->st_mtim.tv_nsec = stx->stx_mtime.tv_nsec;
+	st->st_ctim.tv_sec = stx->stx_ctime.tv_sec;
+	st->st_ctim.tv_nsec = stx->stx_ctime.tv_nsec;
+}
+
+/**
+statx: buffer for struct statx, valid until the operation completes */
+static int sv_uring_file_info(alphahttpd *s, struct ahd_kev *kev, fffd f, void *statx, fffileinfo *fi)
+{
+	int r;
+	struct io_uring_sqe *sqe;
+	if (NULL == (sqe = sv_uring_fop(s, kev, &r))) {
+		if (r < 0)
+			return -1;
+		sv_statx_stat(statx, fi);
+		return 0;
+	}
+
+	uring_prep_statx(sqe, f, statx, sv_uring_udata(kev, UR_FILE));
+	return -1;
+}
+
+/**
+fixed: index of the registered file;  -1: use 'f'
+off: file offset */
+static ffssize sv_uring_file_read(alphahttpd *s, struct ahd_kev *kev, fffd f, int fixed, void *buf, ffsize cap, ffuint64 off)
+{
+	int r;
+	struct io_uring_sqe *sqe;
+	if (NULL == (sqe = sv_uring_fop(s, kev, &r)))
+		return r;
+
+	int buf_index = (sv_uring_buf_registered(s, buf)) ? 0 : -1;
+	if (fixed >= 0)
+		f = fixed;
+	uring_prep_read(sqe, f, (fixed >= 0), buf, ffmin(cap, 0x7ffff000), buf_index, off, sv_uring_udata(kev, UR_FILE));
+	return -1;
+}
+
+/** Write data at the current file position */
+static ffssize sv_uring_file_write(alphahttpd *s, struct ahd_kev *kev, fffd f, const void *data, ffsize n)
+{
+	int r;
+	struct io_uring_sqe *sqe;
+	if (NULL == (sqe = sv_uring_fop(s, kev, &r)))
+		return r;
+
+	uring_prep_write(sqe, f, data, ffmin(n, 0x7ffff000), (ffuint64)-1, sv_uring_udata(kev, UR_FILE));
+	return -1;
+}
+
+/** Cancel pending operations before the connection object is freed.
+An operation may be already executed by a kernel thread (io-wq) and a file operation can't be cancelled at all:
+ the kernel may use the buffers until the operation's completion is received.
+Return 1 if an operation is pending: the caller must wait for its completion */
+static int sv_uring_cancel(alphahttpd *s, struct ahd_kev *kev)
+{
+	static const uint flags[] = { 0, UR_WRITE, UR_FILE };
+	struct ahd_urtask *tasks[] = { &kev->urtask_r, &kev->urtask_w, &kev->urtask_f };
+	uint n = 0, pending = 0;
+
+	for (uint i = 0;  i != FF_COUNT(tasks);  i++) {
+		struct ahd_urtask *t = tasks[i];
+		if (!t->pending)
+			continue;
+		pending = 1;
+		if (t->cancel)
+			continue;
+
+		struct io_uring_sqe *sqe;
+		if (NULL == (sqe = sv_uring_sqe(s)))
+			continue;
+		uring_prep_cancel(sqe, sv_uring_udata(kev, flags[i]), 0);
+		t->cancel = 1;
+		n++;
+	}
+
+	if (n != 0 && 0 > uring_enter(&s->uring, 0))
+		sv_syserrlog(s, "io_uring_enter");
+	return pending;
+}
+
+/** Wait until the socket is ready after the operation has completed with EAGAIN
+ (a socket operation on a non-blocking socket isn't retried by the kernel)
+Return 0 on success */
+static int sv_uring_poll(alphahttpd *s, struct ahd_kev *kev, struct ahd_urtask *t, uint w)
+{
+	struct io_uring_sqe *sqe;
+	if (NULL == (sqe = sv_uring_sqe(s)))
+		return -1;
+	uring_prep_poll(sqe, t->fd, (w) ? POLLOUT : POLLIN, sv_uring_udata(kev, (w) ? UR_WRITE : 0));
+	t->poll = 1;
+	return 0;
+}
+
+/** Handle completed operations
+Return N of completions */
+static uint sv_uring_process(alphahttpd *s)
+{
+	uint n = 0;
+	struct io_uring_cqe *cqe;
+	while (NULL != (cqe = uring_cqe_peek(&s->uring))) {
+		n++;
+		ffuint64 ud = cqe->user_data;
+		int res = cqe->res;
+		uring_cqe_seen(&s->uring);
+
+		struct ahd_kev *kev = (void*)(ffsize)(ud & ~UR_MASK);
+		if (kev == NULL
+			|| (ud & 1) != kev->side)
+			continue;
+
+		if (ud & UR_FILE) {
+			struct ahd_urtask *t = &kev->urtask_f;
+			t->pending = 0;
+			t->cancel = 0;
+			t->done = 1;
+			t->result = res;
+			kev->rhandler(kev->obj);
+			continue;
+		}
+
+		uint w = !!(ud & UR_WRITE);
+		sv_extralog(s, "%p #%L w:%u res:%d"
+			, kev, kev - s->connections, w, res);
+
+		struct ahd_urtask *t = (w) ? &kev->urtask_w : &kev->urtask_r;
+		if (t->poll) {
+			t->poll = 0;
+			if (res >= 0) {
+				// the socket is ready: the handler submits the operation again
+				t->pending = 0;
+				t->cancel = 0;
+				t->done = 0;
+				goto call;
+			}
+
+		} else if (res == -EAGAIN && !t->cancel
+			&& 0 == sv_uring_poll(s, kev, t, w)) {
+			continue;
+		}
+
+		t->pending = 0;
+		t->cancel = 0;
+		t->done = 1;
+		t->result = res;
+
+call:
+		if (w)
+			kev->whandler(kev->obj);
+		else
+			kev->rhandler(kev->obj);
+	}
+	return n;
+}
+
+static int sv_uring_worker(alphahttpd *s)
+{
+	sv_dbglog(s, "entering io_uring loop");
+	uint wait_nr = (s->conf.server.polling_mode) ? 0 : 1;
+	uint adaptive = (!s->conf.server.polling_mode && s->conf.server.polling_usec != 0);
+	uint poll = 0;
+
+	while (!FFINT_READONCE(s->worker_stop)) {
+		sv_accept_next(s);
+
+		sv_wait_begin(s);
+		int r = uring_enter(&s->uring, (s->accept_more || poll) ? 0 : wait_nr);
+		sv_wait_end(s);
+		if (r < 0
+			&& fferr_last() != EINTR && fferr_last() != EBUSY) {
+			sv_sysfatallog(s, "io_uring_enter");
+			sv_offline(s);
+			return -1;
+		}
+
+		uint n = sv_uring_process(s);
+
+		if (s->conf.kcq_set != NULL) {
+			ffkcallq_process_cq(s->kcq.cq);
+			sv_tasks_process(s);
+		}
+
+		sv_busy_end(s, (n != 0));
+		if (adaptive)
+			poll = sv_poll_next(s, (n != 0));
+	}
+	sv_offline(s);
+	sv_dbglog(s, "leaving io_uring loop");
+	return 0;
+}
+
+#endif
@@ -0,0 +1,101 @@
+/** alphahttpd: size-classed buffer pool
+2023, Simon Zolin
+*/
+
+/*
+bufpool_init bufpool_destroy
+bufpool_alloc bufpool_free
+*/
+
+/*
+Class:  0   1   2    3    4
+Size:   4K  8K  16K  32K  64K
+
+Each class has a LIFO list of free buffers: the first bytes of a free buffer store the pointer to the next one.
+Larger buffers are allocated and freed directly.
+*/
+
+#pragma once
+#include <ffbase/base.h>
+
+#define BUFPOOL_MIN_SIZE  4096
+#define BUFPOOL_CLASSES  5
+
+struct bufpool {
+	void *free[BUFPOOL_CLASSES];
+	ffsize free_size, max_free_size;
+};
+
+/**
+max_free_size: max. total size of free buffers kept for reuse */
+static inline void bufpool_init(struct bufpool *p, ffsize max_free_size)
+{
+	ffmem_zero_obj(p);
+	p->max_free_size = max_free_size;
+}
+
+static inline void bufpool_destroy(struct bufpool *p)
+{
+	for (ffuint i = 0;  i != BUFPOOL_CLASSES;  i++) {
+		void *b = p->free[i];
+		while (b != NULL) {
+			void *next = *(void**)b;
+			ffmem_free(b);
+			b = next;
+		}
+		p->free[i] = NULL;
+	}
+	p->free_size = 0;
+}
+
+/** Get size class
+Return -1 if the size is too large */
+static inline int _bufpool_class(ffsize size)
+{
+	for (ffuint i = 0;  i != BUFPOOL_CLASSES;  i++) {
+		if (size <= ((ffsize)BUFPOOL_MIN_SIZE << i))
+			return i;
+	}
+	return -1;
+}
+
+/** Get a buffer of at least 'size' bytes
+cap: [output] actual buffer capacity
+Return NULL on error */
+static inline void* bufpool_alloc(struct bufpool *p, ffsize size, ffsize *cap)
+{
+	int i = _bufpool_class(size);
+	if (i < 0) {
+		*cap = size;
+		return ffmem_alloc(size);
+	}
+
+	*cap = (ffsize)BUFPOOL_MIN_SIZE << i;
+	void *b = p->free[i];
+	if (b != NULL) {
+		p->free[i] = *(void**)b;
+		p->free_size -= *cap;
+		return b;
+	}
+	return ffmem_alloc(*cap);
+}
+
+/** Return the buffer to the pool or free it
+cap: buffer capacity */
+static inline void bufpool_free(struct bufpool *p, void *buf, ffsize cap)
+{
+	if (buf == NULL)
+		return;
+
+	int i = _bufpool_class(cap);
+	if (i < 0
+		|| cap != ((ffsize)BUFPOOL_MIN_SIZE << i)
+		|| p->free_size + cap > p->max_free_size) {
+		ffmem_free(buf);
+		return;
+	}
+
+	*(void**)buf = p->free[i];
+	p->free[i] = buf;
+	p->free_size += cap;
+}
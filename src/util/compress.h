@@ -0,0 +1,150 @@
+/** alphahttpd: streaming compression (gzip, zstd)
+2023, Simon Zolin
+*/
+
+/*
+zcomp_supported
+zcomp_open zcomp_close
+zcomp_process
+*/
+
+/*
+Build with AHD_HAVE_ZLIB (link with -lz) to enable gzip,
+ with AHD_HAVE_ZSTD (link with -lzstd) to enable zstd.
+*/
+
+#pragma once
+#include <ffbase/string.h>
+#ifdef AHD_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef AHD_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+enum ZCOMP_T {
+	ZCOMP_GZIP = 1,
+	ZCOMP_ZSTD,
+};
+
+struct zcomp {
+	ffuint type; // enum ZCOMP_T
+#ifdef AHD_HAVE_ZLIB
+	z_stream gz;
+#endif
+#ifdef AHD_HAVE_ZSTD
+	ZSTD_CCtx *zst;
+#endif
+};
+
+/** Return 1 if the compression type is supported by this build */
+static inline int zcomp_supported(ffuint type)
+{
+	switch (type) {
+#ifdef AHD_HAVE_ZLIB
+	case ZCOMP_GZIP: return 1;
+#endif
+#ifdef AHD_HAVE_ZSTD
+	case ZCOMP_ZSTD: return 1;
+#endif
+	}
+	return 0;
+}
+
+/**
+type: enum ZCOMP_T
+level: 1..9
+Return 0 on success */
+static inline int zcomp_open(struct zcomp *z, ffuint type, int level)
+{
+	ffmem_zero_obj(z);
+	z->type = type;
+
+	switch (type) {
+#ifdef AHD_HAVE_ZLIB
+	case ZCOMP_GZIP:
+		// windowBits + 16: gzip header and trailer
+		if (Z_OK != deflateInit2(&z->gz, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY))
+			return -1;
+		return 0;
+#endif
+
+#ifdef AHD_HAVE_ZSTD
+	case ZCOMP_ZSTD:
+		if (NULL == (z->zst = ZSTD_createCCtx()))
+			return -1;
+		if (ZSTD_isError(ZSTD_CCtx_setParameter(z->zst, ZSTD_c_compressionLevel, level))) {
+			ZSTD_freeCCtx(z->zst);
+			z->zst = NULL;
+			return -1;
+		}
+		return 0;
+#endif
+	}
+
+	z->type = 0;
+	return -1;
+}
+
+static inline void zcomp_close(struct zcomp *z)
+{
+	switch (z->type) {
+#ifdef AHD_HAVE_ZLIB
+	case ZCOMP_GZIP:
+		deflateEnd(&z->gz);
+		break;
+#endif
+
+#ifdef AHD_HAVE_ZSTD
+	case ZCOMP_ZSTD:
+		ZSTD_freeCCtx(z->zst);
+		break;
+#endif
+	}
+	z->type = 0;
+}
+
+/** Compress data
+in: [in/out] input data; shifted by the number of processed bytes
+fin: there's no more input data after `in`
+out: [out] compressed data is appended
+done: [out] set to 1 when all output is written after `fin`
+Return 0 on success;  -1 on error */
+static inline int zcomp_process(struct zcomp *z, ffstr *in, int fin, ffstr *out, ffsize cap, int *done)
+{
+	*done = 0;
+
+	switch (z->type) {
+#ifdef AHD_HAVE_ZLIB
+	case ZCOMP_GZIP: {
+		z->gz.next_in = (void*)in->ptr;
+		z->gz.avail_in = in->len;
+		z->gz.next_out = (void*)(out->ptr + out->len);
+		z->gz.avail_out = cap - out->len;
+		int r = deflate(&z->gz, (fin) ? Z_FINISH : Z_NO_FLUSH);
+		if (r == Z_STREAM_ERROR)
+			return -1;
+		ffstr_shift(in, in->len - z->gz.avail_in);
+		out->len = cap - z->gz.avail_out;
+		*done = (r == Z_STREAM_END);
+		return 0;
+	}
+#endif
+
+#ifdef AHD_HAVE_ZSTD
+	case ZCOMP_ZSTD: {
+		ZSTD_inBuffer ib = { in->ptr, in->len, 0 };
+		ZSTD_outBuffer ob = { out->ptr, cap, out->len };
+		size_t r = ZSTD_compressStream2(z->zst, &ob, &ib, (fin) ? ZSTD_e_end : ZSTD_e_continue);
+		if (ZSTD_isError(r))
+			return -1;
+		ffstr_shift(in, ib.pos);
+		out->len = ob.pos;
+		*done = (fin && r == 0);
+		return 0;
+	}
+#endif
+	}
+
+	return -1;
+}
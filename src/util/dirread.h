@@ -0,0 +1,92 @@
+/** alphahttpd: read directory entries incrementally
+2023, Simon Zolin
+*/
+
+/*
+dirread_open dirread_close
+dirread_next
+dirread_info
+*/
+
+/*
+UNIX: the entries are read from kernel in small blocks (readdir()),
+ so a huge directory can be processed part by part with bounded memory.
+Other systems: the whole directory is read on open (ffdirscan).
+The entries are returned in file system order.
+*/
+
+#pragma once
+#include <FFOS/dirscan.h>
+#include <FFOS/file.h>
+#ifdef FF_UNIX
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
+
+typedef struct dirread {
+#ifdef FF_UNIX
+	DIR *d;
+#else
+	ffdirscan ds;
+#endif
+} dirread;
+
+/** Return 0 on success */
+static inline int dirread_open(dirread *dr, const char *path)
+{
+#ifdef FF_UNIX
+	if (NULL == (dr->d = opendir(path)))
+		return -1;
+	return 0;
+#else
+	ffmem_zero_obj(&dr->ds);
+	return ffdirscan_open(&dr->ds, path, 0);
+#endif
+}
+
+static inline void dirread_close(dirread *dr)
+{
+#ifdef FF_UNIX
+	if (dr->d != NULL) {
+		closedir(dr->d);
+		dr->d = NULL;
+	}
+#else
+	ffdirscan_close(&dr->ds);
+#endif
+}
+
+/** Get the next file name (except "." and "..")
+Return NULL if there are no more entries or on error (fferr_last() != 0) */
+static inline const char* dirread_next(dirread *dr)
+{
+#ifdef FF_UNIX
+	for (;;) {
+		errno = 0;
+		const struct dirent *de = readdir(dr->d);
+		if (de == NULL)
+			return NULL;
+		const char *fn = de->d_name;
+		if (fn[0] == '.'
+			&& (fn[1] == '\0' || (fn[1] == '.' && fn[2] == '\0')))
+			continue;
+		return fn;
+	}
+#else
+	fferr_set(0);
+	return ffdirscan_next(&dr->ds);
+#endif
+}
+
+/** Get properties of the file returned by dirread_next()
+Return 0 on success;  -1 on error or if not supported */
+static inline int dirread_info(dirread *dr, const char *name, fffileinfo *fi)
+{
+#ifdef FF_UNIX
+	return fstatat(dirfd(dr->d), name, fi, 0);
+#else
+	return -1;
+#endif
+}
@@ -0,0 +1,118 @@
+/** alphahttpd: identify known HTTP/1 header fields
+2023, Simon Zolin
+*/
+
+/*
+http_hdr_id
+*/
+
+/*
+A header name is mapped to its ID with a perfect hash:
+ no two known names have the same hash value,
+ so a lookup is one hash computation, one table access and one string comparison.
+The hash uses the name length and 3 characters converted to lower case
+ (all characters allowed in a name are not changed by '|0x20', except letters).
+The coefficients are found by trying all values in 0..63 until there are no collisions for the names below.
+When a name is added, the coefficients and `http_hdr_hashtab` must be regenerated:
+ `tools/http1-hdr-gen.py -g` prints them;  without arguments it checks the current table (`make test-hdr`).
+*/
+
+#pragma once
+#include <ffbase/string.h>
+
+enum HTTP_H {
+	HTTP_H_HOST,
+	HTTP_H_CONNECTION,
+	HTTP_H_CONTENT_LENGTH,
+	HTTP_H_CONTENT_TYPE,
+	HTTP_H_TRANSFER_ENCODING,
+	HTTP_H_EXPECT,
+	HTTP_H_ACCEPT,
+	HTTP_H_ACCEPT_ENCODING,
+	HTTP_H_ACCEPT_LANGUAGE,
+	HTTP_H_IF_MODIFIED_SINCE,
+	HTTP_H_IF_UNMODIFIED_SINCE,
+	HTTP_H_IF_NONE_MATCH,
+	HTTP_H_IF_MATCH,
+	HTTP_H_IF_RANGE,
+	HTTP_H_RANGE,
+	HTTP_H_USER_AGENT,
+	HTTP_H_REFERER,
+	HTTP_H_COOKIE,
+	HTTP_H_AUTHORIZATION,
+	HTTP_H_CACHE_CONTROL,
+	HTTP_H_UPGRADE,
+	HTTP_H_ORIGIN,
+	HTTP_H_X_FORWARDED_FOR,
+	HTTP_H_PRAGMA,
+	HTTP_H_KNOWN, // number of known header fields
+};
+
+static const char http_hdr_names[][20] = {
+	"Host",
+	"Connection",
+	"Content-Length",
+	"Content-Type",
+	"Transfer-Encoding",
+	"Expect",
+	"Accept",
+	"Accept-Encoding",
+	"Accept-Language",
+	"If-Modified-Since",
+	"If-Unmodified-Since",
+	"If-None-Match",
+	"If-Match",
+	"If-Range",
+	"Range",
+	"User-Agent",
+	"Referer",
+	"Cookie",
+	"Authorization",
+	"Cache-Control",
+	"Upgrade",
+	"Origin",
+	"X-Forwarded-For",
+	"Pragma",
+};
+
+// hash -> ID + 1
+static const ffbyte http_hdr_hashtab[64] = {
+	[1] = HTTP_H_UPGRADE + 1,
+	[7] = HTTP_H_CONNECTION + 1,
+	[12] = HTTP_H_AUTHORIZATION + 1,
+	[13] = HTTP_H_USER_AGENT + 1,
+	[16] = HTTP_H_TRANSFER_ENCODING + 1,
+	[19] = HTTP_H_PRAGMA + 1,
+	[21] = HTTP_H_COOKIE + 1,
+	[25] = HTTP_H_IF_RANGE + 1,
+	[27] = HTTP_H_ACCEPT_LANGUAGE + 1,
+	[29] = HTTP_H_X_FORWARDED_FOR + 1,
+	[31] = HTTP_H_ORIGIN + 1,
+	[32] = HTTP_H_ACCEPT_ENCODING + 1,
+	[36] = HTTP_H_CONTENT_TYPE + 1,
+	[37] = HTTP_H_ACCEPT + 1,
+	[41] = HTTP_H_IF_UNMODIFIED_SINCE + 1,
+	[42] = HTTP_H_IF_MODIFIED_SINCE + 1,
+	[43] = HTTP_H_IF_MATCH + 1,
+	[45] = HTTP_H_EXPECT + 1,
+	[49] = HTTP_H_CONTENT_LENGTH + 1,
+	[52] = HTTP_H_IF_NONE_MATCH + 1,
+	[53] = HTTP_H_RANGE + 1,
+	[60] = HTTP_H_REFERER + 1,
+	[62] = HTTP_H_CACHE_CONTROL + 1,
+	[63] = HTTP_H_HOST + 1,
+};
+
+/** Get ID of a known header field (case-insensitive)
+name: non-empty
+Return enum HTTP_H;  -1 if unknown */
+static inline int http_hdr_id(ffstr name)
+{
+	const ffbyte *d = (ffbyte*)name.ptr;
+	ffsize n = name.len;
+	uint h = (n + (d[0] | 0x20) * 2 + (d[n-1] | 0x20) * 6 + (d[n/2] | 0x20)) & 63;
+	int id = (int)http_hdr_hashtab[h] - 1;
+	if (id < 0 || !ffstr_ieqz(&name, http_hdr_names[id]))
+		return -1;
+	return id;
+}
@@ -0,0 +1,210 @@
+/** alphahttpd: vectorized byte scanning for HTTP/1 parser
+2023, Simon Zolin
+*/
+
+/*
+http1_simd_init http1_simd_name
+http_skip_ranges http_findany
+*/
+
+/*
+The implementation is selected once at startup by http1_simd_init() according to CPUID:
+ AVX-512BW (64 bytes per step), AVX2 (32 bytes per step)
+ or the generic ffs_skip_ranges()/ffs_findany() (SSE4.2 with -march=nehalem).
+All threads use the same table `http1_simd`, defined with HTTP1_SIMD_DEFINE in one translation unit;
+ until it's initialized the generic functions are used.
+The vector code is compiled with function-level target attributes,
+ so the same binary (even built with OLD_CPU=1) uses the best variant on any x86 CPU.
+The tail shorter than a vector is processed by the generic function.
+The results are exactly the same as of the generic functions.
+*/
+
+#pragma once
+#include <ffbase/string.h>
+
+#if (defined __x86_64__ || defined __i386__) && defined __GNUC__ && !defined AHD_NO_SIMD
+#define HTTP1_SIMD
+#include <immintrin.h>
+#endif
+
+typedef ffssize (*http_scan_f)(const char *d, ffsize n, const char *set, ffsize set_len);
+
+#ifdef HTTP1_SIMD
+
+#define HTTP1_RANGES_MAX  4
+
+__attribute__((target("avx2")))
+static ffssize http_skip_ranges_avx2(const char *d, ffsize n, const char *ranges, ffsize ranges_len)
+{
+	if (ranges_len > HTTP1_RANGES_MAX * 2)
+		return ffs_skip_ranges(d, n, ranges, ranges_len);
+
+	__m256i lo[HTTP1_RANGES_MAX], span[HTTP1_RANGES_MAX];
+	uint nr = ranges_len / 2;
+	for (uint k = 0;  k != nr;  k++) {
+		lo[k] = _mm256_set1_epi8(ranges[k*2]);
+		span[k] = _mm256_set1_epi8((ffbyte)ranges[k*2+1] - (ffbyte)ranges[k*2]);
+	}
+
+	ffsize i = 0;
+	for (;  i + 32 <= n;  i += 32) {
+		__m256i x = _mm256_loadu_si256((void*)(d + i));
+		__m256i in = _mm256_setzero_si256();
+		for (uint k = 0;  k != nr;  k++) {
+			// (x - lo) <= (hi - lo), unsigned
+			__m256i v = _mm256_sub_epi8(x, lo[k]);
+			in = _mm256_or_si256(in, _mm256_cmpeq_epi8(_mm256_min_epu8(v, span[k]), v));
+		}
+		uint mask = ~(uint)_mm256_movemask_epi8(in);
+		if (mask != 0)
+			return i + __builtin_ctz(mask);
+	}
+
+	ffssize r = ffs_skip_ranges(d + i, n - i, ranges, ranges_len);
+	return (r >= 0) ? (ffssize)i + r : -1;
+}
+
+__attribute__((target("avx2")))
+static ffssize http_findany_avx2(const char *d, ffsize n, const char *anyof, ffsize anyof_len)
+{
+	if (anyof_len > HTTP1_RANGES_MAX)
+		return ffs_findany(d, n, anyof, anyof_len);
+
+	__m256i c[HTTP1_RANGES_MAX];
+	for (uint k = 0;  k != anyof_len;  k++) {
+		c[k] = _mm256_set1_epi8(anyof[k]);
+	}
+
+	ffsize i = 0;
+	for (;  i + 32 <= n;  i += 32) {
+		__m256i x = _mm256_loadu_si256((void*)(d + i));
+		__m256i eq = _mm256_setzero_si256();
+		for (uint k = 0;  k != anyof_len;  k++) {
+			eq = _mm256_or_si256(eq, _mm256_cmpeq_epi8(x, c[k]));
+		}
+		uint mask = _mm256_movemask_epi8(eq);
+		if (mask != 0)
+			return i + __builtin_ctz(mask);
+	}
+
+	ffssize r = ffs_findany(d + i, n - i, anyof, anyof_len);
+	return (r >= 0) ? (ffssize)i + r : -1;
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static ffssize http_skip_ranges_avx512(const char *d, ffsize n, const char *ranges, ffsize ranges_len)
+{
+	if (ranges_len > HTTP1_RANGES_MAX * 2)
+		return ffs_skip_ranges(d, n, ranges, ranges_len);
+
+	__m512i lo[HTTP1_RANGES_MAX], span[HTTP1_RANGES_MAX];
+	uint nr = ranges_len / 2;
+	for (uint k = 0;  k != nr;  k++) {
+		lo[k] = _mm512_set1_epi8(ranges[k*2]);
+		span[k] = _mm512_set1_epi8((ffbyte)ranges[k*2+1] - (ffbyte)ranges[k*2]);
+	}
+
+	ffsize i = 0;
+	for (;  i + 64 <= n;  i += 64) {
+		__m512i x = _mm512_loadu_si512((void*)(d + i));
+		__mmask64 in = 0;
+		for (uint k = 0;  k != nr;  k++) {
+			in |= _mm512_cmple_epu8_mask(_mm512_sub_epi8(x, lo[k]), span[k]);
+		}
+		ffuint64 mask = ~(ffuint64)in;
+		if (mask != 0)
+			return i + __builtin_ctzll(mask);
+	}
+
+	ffssize r = http_skip_ranges_avx2(d + i, n - i, ranges, ranges_len);
+	return (r >= 0) ? (ffssize)i + r : -1;
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static ffssize http_findany_avx512(const char *d, ffsize n, const char *anyof, ffsize anyof_len)
+{
+	if (anyof_len > HTTP1_RANGES_MAX)
+		return ffs_findany(d, n, anyof, anyof_len);
+
+	__m512i c[HTTP1_RANGES_MAX];
+	for (uint k = 0;  k != anyof_len;  k++) {
+		c[k] = _mm512_set1_epi8(anyof[k]);
+	}
+
+	ffsize i = 0;
+	for (;  i + 64 <= n;  i += 64) {
+		__m512i x = _mm512_loadu_si512((void*)(d + i));
+		__mmask64 eq = 0;
+		for (uint k = 0;  k != anyof_len;  k++) {
+			eq |= _mm512_cmpeq_epi8_mask(x, c[k]);
+		}
+		if (eq != 0)
+			return i + __builtin_ctzll(eq);
+	}
+
+	ffssize r = http_findany_avx2(d + i, n - i, anyof, anyof_len);
+	return (r >= 0) ? (ffssize)i + r : -1;
+}
+
+struct http1_simd {
+	http_scan_f skip_ranges;
+	http_scan_f findany;
+	const char *name;
+};
+
+extern struct http1_simd http1_simd;
+
+#define HTTP1_SIMD_DEFINE \
+	struct http1_simd http1_simd = { ffs_skip_ranges, ffs_findany, "generic" };
+
+/** Select the best implementation for this CPU.
+Must be called before the worker threads start. */
+static inline void http1_simd_init()
+{
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512bw")) {
+		http1_simd.skip_ranges = http_skip_ranges_avx512;
+		http1_simd.findany = http_findany_avx512;
+		http1_simd.name = "AVX-512";
+	} else if (__builtin_cpu_supports("avx2")) {
+		http1_simd.skip_ranges = http_skip_ranges_avx2;
+		http1_simd.findany = http_findany_avx2;
+		http1_simd.name = "AVX2";
+	}
+}
+
+/** Get the name of the selected implementation */
+static inline const char* http1_simd_name()
+{
+	return http1_simd.name;
+}
+
+/** Skip the bytes within ranges, e.g. "AZaz"
+ranges_len: max. 8 for the vectorized code
+Return index of the first byte not within ranges;  <0 if all bytes match */
+#define http_skip_ranges(d, n, ranges, ranges_len) \
+	http1_simd.skip_ranges(d, n, ranges, ranges_len)
+
+/** Find any of the bytes
+anyof_len: max. 4 for the vectorized code
+Return index of the first matching byte;  <0 if not found */
+#define http_findany(d, n, anyof, anyof_len) \
+	http1_simd.findany(d, n, anyof, anyof_len)
+
+#else // !HTTP1_SIMD
+
+#define HTTP1_SIMD_DEFINE
+
+static inline void http1_simd_init()
+{
+}
+
+static inline const char* http1_simd_name()
+{
+	return "generic";
+}
+
+#define http_skip_ranges(d, n, ranges, ranges_len)  ffs_skip_ranges(d, n, ranges, ranges_len)
+#define http_findany(d, n, anyof, anyof_len)  ffs_findany(d, n, anyof, anyof_len)
+
+#endif
@@ -48,7 +48,7 @@ static const ffushort http_status_code[] = {
 };
 static const char http_status_msg[][32] = {
 	"OK",
-	"Partial",
+	"Partial Content",
 
 	"Moved Permanently",
 	"Found",
@@ -6,6 +6,8 @@
 http_req_parse http_req_write
 http_resp_parse http_resp_write
 http_hdr_parse http_hdr_write
+http_range_parse http_etag_match
+http_accept_encoding
 httpchunked_parse httpchunked_write
 httpurl_escape httpurl_unescape
 httpurl_split
@@ -45,6 +47,7 @@ Example HTTPS request via HTTP proxy:
 */
 
 #pragma once
+#include <util/http1-simd.h>
 #include <ffbase/string.h>
 
 static int httpurl_escape(char *buf, ffsize cap, ffstr url);
@@ -60,7 +63,7 @@ static inline int http_req_parse(ffstr req, ffstr *method, ffstr *path, ffstr *p
 {
 	const char *d = req.ptr, *end = req.ptr + req.len;
 
-	int r = ffs_skip_ranges(d, end - d, "\x41\x5a", 2); // "A-Z"
+	int r = http_skip_ranges(d, end - d, "\x41\x5a", 2); // "A-Z"
 	if (r < 0)
 		return 0;
 	if (r == 0 || d[r] != ' ')
@@ -76,7 +79,7 @@ static inline int http_req_parse(ffstr req, ffstr *method, ffstr *path, ffstr *p
 		d++;
 	}
 
-	r = ffs_skip_ranges(d, end - d, "\x21\x7e", 2); // printable ANSI
+	r = http_skip_ranges(d, end - d, "\x21\x7e", 2); // printable ANSI
 	if (r < 0)
 		return 0;
 	if (r == 0 || d[r] != ' ')
@@ -95,7 +98,7 @@ static inline int http_req_parse(ffstr req, ffstr *method, ffstr *path, ffstr *p
 	if (d+8 <= end
 		&& (ffint_be_cpu64(*(ffuint64*)d) & ~1ULL) != 0x485454502f312e30) // "HTTP/1.0|1"
 		return -1;
-	r = ffs_skip_ranges(d, end - d, "\x21\x7e", 2); // printable ANSI
+	r = http_skip_ranges(d, end - d, "\x21\x7e", 2); // printable ANSI
 	if (r < 0) {
 		if (d+8 < end)
 			return -1;
@@ -135,7 +138,7 @@ static inline int http_resp_parse(ffstr resp, ffstr *proto, ffuint *code, ffstr
 {
 	const char *d = resp.ptr, *end = resp.ptr + resp.len;
 
-	int r = ffs_skip_ranges(d, end - d, "\x21\x7e", 2); // printable ANSI
+	int r = http_skip_ranges(d, end - d, "\x21\x7e", 2); // printable ANSI
 	if (r < 0)
 		return 0;
 	if (r == 0 || d[r] != ' ')
@@ -143,7 +146,7 @@ static inline int http_resp_parse(ffstr resp, ffstr *proto, ffuint *code, ffstr
 	ffstr_set(proto, d, r);
 	d += r+1;
 
-	r = ffs_skip_ranges(d, end - d, "\x30\x39", 2); // "0-9"
+	r = http_skip_ranges(d, end - d, "\x30\x39", 2); // "0-9"
 	if (r < 0)
 		return 0;
 	else if (r != 3 || d[r] != ' ')
@@ -151,7 +154,7 @@ static inline int http_resp_parse(ffstr resp, ffstr *proto, ffuint *code, ffstr
 	*code = (d[0] - '0') * 100 + (d[1] - '0') * 10 + d[2] - '0';
 	d += 4;
 
-	r = ffs_skip_ranges(d, end - d, "\x20\x7e", 2); // basic latin
+	r = http_skip_ranges(d, end - d, "\x20\x7e", 2); // basic latin
 	if (r < 0)
 		return 0;
 	ffstr_set(msg, d, r);
@@ -181,7 +184,7 @@ static inline int http_hdr_parse(ffstr data, ffstr *name, ffstr *value)
 {
 	const char *d = data.ptr, *end = data.ptr+data.len;
 
-	int r = ffs_skip_ranges(d, end - d, "\x2d\x2d\x30\x39\x41\x5a\x61\x7a", 8); // "-0-9A-Za-z"
+	int r = http_skip_ranges(d, end - d, "\x2d\x2d\x30\x39\x41\x5a\x61\x7a", 8); // "-0-9A-Za-z"
 	if (r < 0)
 		return 0;
 	else if (r == 0)
@@ -199,7 +202,7 @@ static inline int http_hdr_parse(ffstr data, ffstr *name, ffstr *value)
 		d++;
 	}
 
-	r = ffs_findany(d, end - d, "\r\n", 2);
+	r = http_findany(d, end - d, "\r\n", 2);
 	if (r < 0)
 		return 0;
 	ffstr_set(value, d, r);
@@ -291,16 +294,123 @@ static inline int http_hdr_write(char *buf, ffsize cap, ffstr name, ffstr val)
 	return n;
 }
 
+enum HTTP_ENC {
+	HTTP_ENC_BR = 1,
+	HTTP_ENC_ZSTD = 2,
+	HTTP_ENC_GZIP = 4,
+};
+
+/** Get the set of content encodings accepted by client, e.g. "gzip, deflate, br;q=0.5"
+Return enum HTTP_ENC */
+static inline ffuint http_accept_encoding(ffstr val)
+{
+	ffuint m = 0;
+	while (val.len != 0) {
+		ffstr t, name, params, in = val;
+		ffstr_splitby(&in, ',', &t, &val);
+		ffstr_splitby(&t, ';', &name, &params);
+		ffstr_trimwhite(&name);
+		ffstr_trimwhite(&params);
+
+		if (ffstr_imatchcz(&params, "q=0")) {
+			ffstr_shift(&params, 3);
+			ffstr_skipchar(&params, '.');
+			ffstr_skipchar(&params, '0');
+			if (params.len == 0)
+				continue; // "q=0": not acceptable
+		}
+
+		if (ffstr_ieqcz(&name, "br"))
+			m |= HTTP_ENC_BR;
+		else if (ffstr_ieqcz(&name, "zstd"))
+			m |= HTTP_ENC_ZSTD;
+		else if (ffstr_ieqcz(&name, "gzip") || ffstr_ieqcz(&name, "x-gzip"))
+			m |= HTTP_ENC_GZIP;
+		else if (ffstr_eqz(&name, "*"))
+			m |= HTTP_ENC_BR | HTTP_ENC_ZSTD | HTTP_ENC_GZIP;
+	}
+	return m;
+}
+
+/** Check if If-None-Match value (e.g. "\"1\", W/\"2\"" or "*") matches the entity tag (weak comparison)
+etag: e.g. "\"1\"" */
+static inline int http_etag_match(ffstr inm, ffstr etag)
+{
+	ffstr_trimwhite(&inm);
+	if (ffstr_eqz(&inm, "*"))
+		return 1;
+
+	while (inm.len != 0) {
+		ffstr t, in = inm;
+		ffstr_splitby(&in, ',', &t, &inm);
+		ffstr_trimwhite(&t);
+		if (ffstr_matchcz(&t, "W/"))
+			ffstr_shift(&t, 2);
+		if (ffstr_eq2(&t, &etag))
+			return 1;
+	}
+	return 0;
+}
+
+/** Parse a single byte range, e.g. "bytes=0-99", "bytes=100-", "bytes=-100"
+size: content size
+off, len: [output] byte range within content
+Return 0 on success
+ >0: range is not satisfiable
+ <0: unsupported or invalid value: the whole content should be sent */
+static inline int http_range_parse(ffstr val, ffuint64 size, ffuint64 *off, ffuint64 *len)
+{
+	if (!ffstr_imatchcz(&val, "bytes="))
+		return -1;
+	ffstr_shift(&val, 6);
+	if (ffstr_findchar(&val, ',') >= 0)
+		return -1; // multiple ranges
+	ffstr_trimwhite(&val);
+
+	ffstr first, last;
+	if (0 > ffstr_splitby(&val, '-', &first, &last))
+		return -1;
+
+	ffuint64 a, b;
+	if (first.len == 0) { // "-N": last N bytes
+		if (!ffstr_toint(&last, &b, FFS_INT64))
+			return -1;
+		if (b == 0 || size == 0)
+			return 1;
+		b = ffmin64(b, size);
+		*off = size - b;
+		*len = b;
+		return 0;
+	}
+
+	if (!ffstr_toint(&first, &a, FFS_INT64))
+		return -1;
+	b = (ffuint64)-1;
+	if (last.len != 0) {
+		if (!ffstr_toint(&last, &b, FFS_INT64)
+			|| b < a)
+			return -1;
+	}
+
+	if (a >= size)
+		return 1;
+	b = ffmin64(b, size - 1);
+	*off = a;
+	*len = b - a + 1;
+	return 0;
+}
+
 
 struct httpchunked {
 	ffuint state;
 	ffuint last_chunk;
 	ffuint64 size;
+	ffsize done_len; // N of bytes processed by the call which returned -1
 };
 
 /** Parse chunked data
 Return N of bytes processed, `output` contains unchunked data (if any)
- -1 if done
+ -1 if done: the data after `done_len` bytes doesn't belong to the chunked body
  <0 on error */
 static inline ffssize httpchunked_parse(struct httpchunked *c, ffstr input, ffstr *output)
 {
@@ -351,6 +461,7 @@ static inline ffssize httpchunked_parse(struct httpchunked *c, ffstr input, ffst
 					st = I_DAT_CR;
 				} else if (ch == '\n') {
 					if (c->last_chunk) {
+						c->done_len = i + 1;
 						i = -1;
 						goto end;
 					}
@@ -371,6 +482,7 @@ static inline ffssize httpchunked_parse(struct httpchunked *c, ffstr input, ffst
 			if (ch != '\n')
 				return -2;
 			if (c->last_chunk) {
+				c->done_len = i + 1;
 				i = -1;
 				goto end;
 			}
@@ -0,0 +1,58 @@
+/** alphahttpd: intrusive list of items ordered by last use
+2023, Simon Zolin
+*/
+
+/*
+lru_push lru_unlink
+lru_use
+*/
+
+/*
+The most recently used item is first, the least recently used is last.
+An item is embedded into the user's object, which is obtained from it via FF_STRUCTPTR().
+*/
+
+#pragma once
+#include <ffbase/base.h>
+
+struct lru_item {
+	struct lru_item *prev, *next;
+};
+
+struct lru_list {
+	struct lru_item *first, *last;
+};
+
+/** Add item as the most recently used */
+static inline void lru_push(struct lru_list *l, struct lru_item *it)
+{
+	it->prev = NULL;
+	it->next = l->first;
+	if (l->first != NULL)
+		l->first->prev = it;
+	else
+		l->last = it;
+	l->first = it;
+}
+
+static inline void lru_unlink(struct lru_list *l, struct lru_item *it)
+{
+	if (it->prev != NULL)
+		it->prev->next = it->next;
+	else
+		l->first = it->next;
+
+	if (it->next != NULL)
+		it->next->prev = it->prev;
+	else
+		l->last = it->prev;
+
+	it->prev = it->next = NULL;
+}
+
+/** Mark item as the most recently used */
+static inline void lru_use(struct lru_list *l, struct lru_item *it)
+{
+	lru_unlink(l, it);
+	lru_push(l, it);
+}
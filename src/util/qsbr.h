@@ -0,0 +1,134 @@
+/** alphahttpd: quiescent-state-based reclamation of shared memory
+2023, Simon Zolin
+*/
+
+/*
+qsbr_init qsbr_destroy
+qsbr_register
+qsbr_online qsbr_offline
+qsbr_retire qsbr_reclaim
+*/
+
+/*
+Readers (workers) access shared objects without locks and without reference counting.
+A worker is online while it processes events, and offline while it waits for new events:
+ it must not hold pointers to shared objects while offline.
+
+A writer unpublishes an object and then retires it with a new epoch number.
+The object is freed when every worker has been offline or has started a new loop iteration
+ since the object was retired, i.e. all worker epochs are >= object's epoch.
+*/
+
+#pragma once
+#include <ffbase/base.h>
+
+#define QSBR_OFFLINE  ((ffuint64)-1)
+
+struct qsbr_slot {
+	ffuint64 epoch;
+	char pad[64 - sizeof(ffuint64)]; // don't share cache line with other workers
+};
+
+struct qsbr_node {
+	struct qsbr_node *next;
+	ffuint64 epoch;
+	ffsize size;
+};
+
+struct qsbr {
+	ffuint64 epoch;
+	ffuint n, n_registered;
+	struct qsbr_slot *slots;
+	struct qsbr_node *retired; // writer-only
+};
+
+/**
+workers: max. number of workers
+Return 0 on success */
+static inline int qsbr_init(struct qsbr *q, ffuint workers)
+{
+	ffmem_zero_obj(q);
+	if (NULL == (q->slots = ffmem_align(workers * sizeof(struct qsbr_slot), 64)))
+		return -1;
+	for (ffuint i = 0;  i != workers;  i++) {
+		q->slots[i].epoch = QSBR_OFFLINE;
+	}
+	q->n = workers;
+	q->epoch = 1;
+	return 0;
+}
+
+/** Free all retired objects */
+static inline void qsbr_destroy(struct qsbr *q)
+{
+	struct qsbr_node *nd = q->retired;
+	while (nd != NULL) {
+		struct qsbr_node *next = nd->next;
+		ffmem_free(nd);
+		nd = next;
+	}
+	ffmem_alignfree(q->slots);
+	ffmem_zero_obj(q);
+}
+
+/** Get slot for a new worker
+Return -1 if all slots are taken */
+static inline int qsbr_register(struct qsbr *q)
+{
+	ffuint i = __atomic_fetch_add(&q->n_registered, 1, __ATOMIC_RELAXED);
+	if (i >= q->n)
+		return -1;
+	return i;
+}
+
+/** Worker starts (or continues after a quiescent state) accessing shared objects */
+static inline void qsbr_online(struct qsbr *q, int slot)
+{
+	ffuint64 e = __atomic_load_n(&q->epoch, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&q->slots[slot].epoch, e, __ATOMIC_SEQ_CST);
+}
+
+/** Worker doesn't access shared objects until the next qsbr_online() */
+static inline void qsbr_offline(struct qsbr *q, int slot)
+{
+	__atomic_store_n(&q->slots[slot].epoch, QSBR_OFFLINE, __ATOMIC_RELEASE);
+}
+
+/** Free the unpublished object after all readers stop using it.
+nd: object allocated with ffmem_alloc() (node is at offset 0);
+ the caller sets nd->size
+Writers must be serialized by the caller. */
+static inline void qsbr_retire(struct qsbr *q, struct qsbr_node *nd)
+{
+	nd->epoch = __atomic_add_fetch(&q->epoch, 1, __ATOMIC_SEQ_CST);
+	nd->next = q->retired;
+	q->retired = nd;
+}
+
+/** Free the retired objects that are no longer used by readers
+Writers must be serialized by the caller.
+Return total size of freed objects */
+static inline ffsize qsbr_reclaim(struct qsbr *q)
+{
+	if (q->retired == NULL)
+		return 0;
+
+	ffuint64 safe = QSBR_OFFLINE;
+	for (ffuint i = 0;  i != q->n;  i++) {
+		ffuint64 e = __atomic_load_n(&q->slots[i].epoch, __ATOMIC_SEQ_CST);
+		safe = ffmin64(safe, e);
+	}
+
+	ffsize freed = 0;
+	struct qsbr_node **pnd = &q->retired, *nd;
+	while (NULL != (nd = *pnd)) {
+		if (nd->epoch <= safe) {
+			*pnd = nd->next;
+			freed += nd->size;
+			ffmem_free(nd);
+			continue;
+		}
+		pnd = &nd->next;
+	}
+	return freed;
+}
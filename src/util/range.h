@@ -6,6 +6,8 @@
 #include <ffbase/string.h>
 
 // ffstr requires 16 bytes; range16 requires only 4 bytes
+#define RANGE16_MAX  0xffff
+
 typedef struct range16 {
 	ffushort off, len;
 } range16;
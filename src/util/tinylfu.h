@@ -0,0 +1,82 @@
+/** alphahttpd: TinyLFU frequency sketch
+2023, Simon Zolin
+*/
+
+/*
+tinylfu_init tinylfu_destroy
+tinylfu_add tinylfu_estimate
+*/
+
+/*
+Count-Min sketch: 4 rows of 4-bit saturating counters (stored in bytes).
+After `width * 8` additions all counters are halved, so that old popularity fades out.
+*/
+
+#pragma once
+#include <ffbase/base.h>
+
+#define TINYLFU_DEPTH  4
+#define TINYLFU_MAXCOUNT  15
+
+struct tinylfu {
+	ffbyte *counters; // [DEPTH][width]
+	ffuint mask; // width - 1
+	ffuint additions, sample_size;
+};
+
+/**
+width: number of counters in a row; rounded up to a power of 2
+Return 0 on success */
+static inline int tinylfu_init(struct tinylfu *t, ffuint width)
+{
+	ffmem_zero_obj(t);
+	width = ffint_align_power2(ffmax(width, 64));
+	if (NULL == (t->counters = ffmem_calloc(TINYLFU_DEPTH, width)))
+		return -1;
+	t->mask = width - 1;
+	t->sample_size = width * 8;
+	return 0;
+}
+
+static inline void tinylfu_destroy(struct tinylfu *t)
+{
+	ffmem_free(t->counters);
+	t->counters = NULL;
+}
+
+static inline ffuint _tinylfu_index(const struct tinylfu *t, ffuint hash, ffuint row)
+{
+	ffuint h = hash + row * ((hash >> 16) | (hash << 16) | 1) * 0x9e3779b1;
+	return row * (t->mask + 1) + (h & t->mask);
+}
+
+/** Get estimated number of accesses */
+static inline ffuint tinylfu_estimate(const struct tinylfu *t, ffuint hash)
+{
+	ffuint n = TINYLFU_MAXCOUNT;
+	for (ffuint i = 0;  i != TINYLFU_DEPTH;  i++) {
+		n = ffmin(n, t->counters[_tinylfu_index(t, hash, i)]);
+	}
+	return n;
+}
+
+static inline void _tinylfu_age(struct tinylfu *t)
+{
+	for (ffuint i = 0;  i != TINYLFU_DEPTH * (t->mask + 1);  i++) {
+		t->counters[i] >>= 1;
+	}
+	t->additions /= 2;
+}
+
+/** Record an access */
+static inline void tinylfu_add(struct tinylfu *t, ffuint hash)
+{
+	for (ffuint i = 0;  i != TINYLFU_DEPTH;  i++) {
+		ffbyte *c = &t->counters[_tinylfu_index(t, hash, i)];
+		if (*c != TINYLFU_MAXCOUNT)
+			(*c)++;
+	}
+
+	if (++t->additions == t->sample_size)
+		_tinylfu_age(t);
+}
@@ -0,0 +1,154 @@
+/** alphahttpd: hashed timing wheel
+2023, Simon Zolin
+*/
+
+/*
+twheel_init
+twheel_add twheel_remove
+twheel_active
+twheel_process
+*/
+
+/*
+Each slot holds the list of timers that expire at (slot_tick + N * TWHEEL_SLOTS) ticks.
+Adding and removing a timer is O(1).
+Restarting an active timer with a later expiration time only updates its expiration time (lazy re-arming):
+ when the slot comes up, the timer that doesn't expire yet is moved to the proper slot.
+Timers never fire earlier than requested, but may fire up to 1 tick later.
+*/
+
+#pragma once
+#include <ffbase/base.h>
+
+#define TWHEEL_SLOTS  512 // power of 2
+
+typedef void (*twheel_func)(void *param);
+
+struct twheel_link {
+	struct twheel_link *next, *prev;
+};
+
+struct twheel_node {
+	struct twheel_link link; // linked if next != NULL
+	ffuint64 expire_ms;
+	ffuint64 slot_tick; // tick of the slot where the node is linked
+	twheel_func func;
+	void *param;
+	int interval_msec;
+};
+
+struct twheel {
+	struct twheel_link slots[TWHEEL_SLOTS];
+	ffuint64 tick; // last processed tick
+	ffuint tick_msec;
+	ffuint started :1;
+};
+
+/**
+tick_msec: wheel resolution (interval between twheel_process() calls) */
+static inline void twheel_init(struct twheel *w, ffuint tick_msec)
+{
+	ffmem_zero_obj(w);
+	for (ffuint i = 0;  i != TWHEEL_SLOTS;  i++) {
+		w->slots[i].next = w->slots[i].prev = &w->slots[i];
+	}
+	w->tick_msec = tick_msec;
+}
+
+static inline int twheel_active(const struct twheel_node *t)
+{
+	return (t->link.next != NULL);
+}
+
+static inline void _twheel_unlink(struct twheel_link *l)
+{
+	l->prev->next = l->next;
+	l->next->prev = l->prev;
+	l->next = l->prev = NULL;
+}
+
+static inline void _twheel_link(struct twheel *w, struct twheel_node *t)
+{
+	ffuint64 tick = (t->expire_ms + w->tick_msec - 1) / w->tick_msec;
+	if (tick <= w->tick)
+		tick = w->tick + 1;
+	t->slot_tick = tick;
+
+	struct twheel_link *head = &w->slots[tick & (TWHEEL_SLOTS - 1)];
+	t->link.next = head;
+	t->link.prev = head->prev;
+	head->prev->next = &t->link;
+	head->prev = &t->link;
+}
+
+/** Add new timer or restart the active one
+interval_msec: >0: periodic;  <0: one-shot */
+static inline void twheel_add(struct twheel *w, struct twheel_node *t, ffuint64 now_ms, int interval_msec, twheel_func func, void *param)
+{
+	t->expire_ms = now_ms + ((interval_msec > 0) ? interval_msec : -interval_msec);
+	t->func = func;
+	t->param = param;
+	t->interval_msec = interval_msec;
+
+	if (twheel_active(t)) {
+		if (t->expire_ms >= t->slot_tick * w->tick_msec)
+			return; // the timer will be moved when its slot comes up
+		_twheel_unlink(&t->link);
+	}
+	_twheel_link(w, t);
+}
+
+/** Stop the timer
+Return 1 if the timer was active */
+static inline int twheel_remove(struct twheel *w, struct twheel_node *t)
+{
+	if (!twheel_active(t))
+		return 0;
+	_twheel_unlink(&t->link);
+	return 1;
+}
+
+/** Call handlers of the expired timers */
+static inline void twheel_process(struct twheel *w, ffuint64 now_ms)
+{
+	ffuint64 now_tick = now_ms / w->tick_msec;
+	if (!w->started) {
+		w->started = 1;
+		w->tick = now_tick;
+		return;
+	}
+
+	if (now_tick > w->tick + TWHEEL_SLOTS)
+		w->tick = now_tick - TWHEEL_SLOTS; // each slot is processed once
+
+	while (w->tick != now_tick) {
+		w->tick++;
+		struct twheel_link *head = &w->slots[w->tick & (TWHEEL_SLOTS - 1)];
+		if (head->next == head)
+			continue;
+
+		// detach the list: handlers may add or remove any timers
+		struct twheel_link list;
+		list.next = head->next;
+		list.prev = head->prev;
+		list.next->prev = &list;
+		list.prev->next = &list;
+		head->next = head->prev = head;
+
+		while (list.next != &list) {
+			struct twheel_node *t = FF_STRUCTPTR(struct twheel_node, link, list.next);
+			_twheel_unlink(&t->link);
+
+			if (t->expire_ms > now_ms) {
+				_twheel_link(w, t);
+				continue;
+			}
+
+			if (t->interval_msec > 0) {
+				t->expire_ms = now_ms + t->interval_msec;
+				_twheel_link(w, t);
+			}
+			t->func(t->param);
+		}
+	}
+}
@@ -0,0 +1,274 @@
+/** alphahttpd: minimal io_uring interface (Linux)
+2023, Simon Zolin
+*/
+
+/*
+uring_init uring_close
+uring_register uring_op_supported
+uring_sqe uring_enter
+uring_cqe_peek uring_cqe_seen
+uring_prep_rw uring_prep_recv uring_prep_writev uring_prep_accept
+uring_prep_poll uring_prep_timeout uring_prep_cancel
+uring_prep_openat uring_prep_statx uring_prep_read uring_prep_write
+*/
+
+/*
+SQ ring (user -> kernel):
+	[head ... tail) entries are owned by kernel;
+	we fill SQEs at `sq_local_tail` and publish them all at once with uring_enter().
+
+CQ ring (kernel -> user):
+	[head ... tail) entries are owned by user;
+	uring_cqe_seen() returns the entry back to kernel.
+*/
+
+#pragma once
+#include <ffbase/base.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+struct uring {
+	int fd;
+	ffuint sq_entries;
+	ffuint sq_local_tail;
+	ffuint *sq_head, *sq_tail, *sq_mask;
+	struct io_uring_sqe *sqes;
+	ffuint *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	void *sq_ring, *cq_ring;
+	ffsize sq_ring_size, cq_ring_size, sqes_size;
+};
+
+static inline void uring_close(struct uring *u)
+{
+	if (u->sqes != NULL)
+		munmap(u->sqes, u->sqes_size);
+	if (u->cq_ring != NULL && u->cq_ring != u->sq_ring)
+		munmap(u->cq_ring, u->cq_ring_size);
+	if (u->sq_ring != NULL)
+		munmap(u->sq_ring, u->sq_ring_size);
+	if (u->fd > 0)
+		close(u->fd);
+	ffmem_zero_obj(u);
+	u->fd = -1;
+}
+
+/** Create a ring and map its memory
+Return 0 on success;  !=0 on error (errno is set) */
+static inline int uring_init(struct uring *u, ffuint entries)
+{
+	int e;
+	ffmem_zero_obj(u);
+	struct io_uring_params p = {};
+	if (0 > (u->fd = syscall(__NR_io_uring_setup, entries, &p))) {
+		u->fd = -1;
+		return -1;
+	}
+
+	u->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(ffuint);
+	u->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		u->sq_ring_size = u->cq_ring_size = ffmax(u->sq_ring_size, u->cq_ring_size);
+
+	u->sq_ring = mmap(NULL, u->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+	if (u->sq_ring == MAP_FAILED) {
+		u->sq_ring = NULL;
+		goto err;
+	}
+
+	u->cq_ring = u->sq_ring;
+	if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+		u->cq_ring = mmap(NULL, u->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+		if (u->cq_ring == MAP_FAILED) {
+			u->cq_ring = NULL;
+			goto err;
+		}
+	}
+
+	u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	u->sqes = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+	if (u->sqes == MAP_FAILED) {
+		u->sqes = NULL;
+		goto err;
+	}
+
+	u->sq_entries = p.sq_entries;
+	u->sq_head = FF_PTR(u->sq_ring, p.sq_off.head);
+	u->sq_tail = FF_PTR(u->sq_ring, p.sq_off.tail);
+	u->sq_mask = FF_PTR(u->sq_ring, p.sq_off.ring_mask);
+	u->sq_local_tail = *u->sq_tail;
+
+	// SQ index array maps 1:1 to SQE array
+	ffuint *sq_array = FF_PTR(u->sq_ring, p.sq_off.array);
+	for (ffuint i = 0;  i != p.sq_entries;  i++) {
+		sq_array[i] = i;
+	}
+
+	u->cq_head = FF_PTR(u->cq_ring, p.cq_off.head);
+	u->cq_tail = FF_PTR(u->cq_ring, p.cq_off.tail);
+	u->cq_mask = FF_PTR(u->cq_ring, p.cq_off.ring_mask);
+	u->cqes = FF_PTR(u->cq_ring, p.cq_off.cqes);
+	return 0;
+
+err:
+	e = errno;
+	uring_close(u);
+	errno = e;
+	return -1;
+}
+
+/** Register resources (buffers, files)
+Return 0 on success;  <0 on error (errno is set) */
+static inline int uring_register(struct uring *u, ffuint opcode, const void *arg, ffuint n)
+{
+	return syscall(__NR_io_uring_register, u->fd, opcode, arg, n);
+}
+
+/** Return 1 if the operation is supported by kernel */
+static inline int uring_op_supported(struct uring *u, ffuint op)
+{
+	struct {
+		struct io_uring_probe p;
+		struct io_uring_probe_op ops[256];
+	} pr = {};
+	if (0 != uring_register(u, IORING_REGISTER_PROBE, &pr, 256))
+		return 0;
+	return (op <= pr.p.last_op
+		&& (pr.p.ops[op].flags & IO_URING_OP_SUPPORTED));
+}
+
+/** Get a free zeroed SQE
+Return NULL if SQ ring is full */
+static inline struct io_uring_sqe* uring_sqe(struct uring *u)
+{
+	ffuint head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+	if (u->sq_local_tail - head == u->sq_entries)
+		return NULL;
+
+	struct io_uring_sqe *sqe = &u->sqes[u->sq_local_tail & *u->sq_mask];
+	u->sq_local_tail++;
+	ffmem_zero_obj(sqe);
+	return sqe;
+}
+
+/** Submit all new SQEs and wait for completions
+wait_nr: minimum number of completions to wait for
+Return N of submitted SQEs
+ <0 on error (errno is set) */
+static inline int uring_enter(struct uring *u, ffuint wait_nr)
+{
+	__atomic_store_n(u->sq_tail, u->sq_local_tail, __ATOMIC_RELEASE);
+	ffuint n = u->sq_local_tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+	if (n == 0 && wait_nr == 0)
+		return 0;
+
+	ffuint flags = (wait_nr != 0) ? IORING_ENTER_GETEVENTS : 0;
+	return syscall(__NR_io_uring_enter, u->fd, n, wait_nr, flags, NULL, 0);
+}
+
+/** Get the next completed entry
+Return NULL if CQ ring is empty */
+static inline struct io_uring_cqe* uring_cqe_peek(struct uring *u)
+{
+	ffuint head = *u->cq_head;
+	if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE))
+		return NULL;
+	return &u->cqes[head & *u->cq_mask];
+}
+
+/** Release the entry returned by uring_cqe_peek() */
+static inline void uring_cqe_seen(struct uring *u)
+{
+	__atomic_store_n(u->cq_head, *u->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+
+static inline void uring_prep_rw(struct io_uring_sqe *sqe, ffuint op, int fd, const void *addr, ffuint len, ffuint64 off, ffuint64 user_data)
+{
+	sqe->opcode = op;
+	sqe->fd = fd;
+	sqe->addr = (ffsize)addr;
+	sqe->len = len;
+	sqe->off = off;
+	sqe->user_data = user_data;
+}
+
+static inline void uring_prep_recv(struct io_uring_sqe *sqe, int sk, void *buf, ffuint cap, ffuint64 user_data)
+{
+	uring_prep_rw(sqe, IORING_OP_RECV, sk, buf, cap, 0, user_data);
+}
+
+static inline void uring_prep_writev(struct io_uring_sqe *sqe, int fd, const struct iovec *iov, ffuint iov_n, ffuint64 user_data)
+{
+	uring_prep_rw(sqe, IORING_OP_WRITEV, fd, iov, iov_n, 0, user_data);
+}
+
+/**
+addr, addrlen: must be valid until the operation completes */
+static inline void uring_prep_accept(struct io_uring_sqe *sqe, int lsk, void *addr, ffuint *addrlen, ffuint flags, ffuint64 user_data)
+{
+	uring_prep_rw(sqe, IORING_OP_ACCEPT, lsk, addr, 0, (ffsize)addrlen, user_data);
+	sqe->accept_flags = flags;
+}
+
+/** One-shot readiness notification */
+static inline void uring_prep_poll(struct io_uring_sqe *sqe, int fd, ffuint events, ffuint64 user_data)
+{
+	uring_prep_rw(sqe, IORING_OP_POLL_ADD, fd, NULL, 0, 0, user_data);
+	sqe->poll32_events = events;
+}
+
+/**
+ts: must be valid until the operation completes
+Operation completes with -ETIME */
+static inline void uring_prep_timeout(struct io_uring_sqe *sqe, struct __kernel_timespec *ts, ffuint64 user_data)
+{
+	uring_prep_rw(sqe, IORING_OP_TIMEOUT, -1, ts, 1, 0, user_data);
+}
+
+/** Cancel the operation with the specified user data */
+static inline void uring_prep_cancel(struct io_uring_sqe *sqe, ffuint64 target, ffuint64 user_data)
+{
+	uring_prep_rw(sqe, IORING_OP_ASYNC_CANCEL, -1, (void*)(ffsize)target, 0, 0, user_data);
+}
+
+/**
+name: must be valid until the operation completes */
+static inline void uring_prep_openat(struct io_uring_sqe *sqe, const char *name, ffuint flags, ffuint64 user_data)
+{
+	uring_prep_rw(sqe, IORING_OP_OPENAT, AT_FDCWD, name, 0, 0, user_data);
+	sqe->open_flags = flags;
+}
+
+/** Get properties of the opened file
+stx: must be valid until the operation completes */
+static inline void uring_prep_statx(struct io_uring_sqe *sqe, int fd, struct statx *stx, ffuint64 user_data)
+{
+	uring_prep_rw(sqe, IORING_OP_STATX, fd, "", STATX_BASIC_STATS, (ffsize)stx, user_data);
+	sqe->statx_flags = AT_EMPTY_PATH;
+}
+
+/**
+fixed_file: `fd` is the index of the registered file
+buf_index: index of the registered buffer containing `buf`;  -1: the buffer isn't registered
+off: -1: use and advance the current file position */
+static inline void uring_prep_read(struct io_uring_sqe *sqe, int fd, ffuint fixed_file, void *buf, ffuint cap, int buf_index, ffuint64 off, ffuint64 user_data)
+{
+	ffuint op = (buf_index >= 0) ? IORING_OP_READ_FIXED : IORING_OP_READ;
+	uring_prep_rw(sqe, op, fd, buf, cap, off, user_data);
+	if (buf_index >= 0)
+		sqe->buf_index = buf_index;
+	if (fixed_file)
+		sqe->flags |= IOSQE_FIXED_FILE;
+}
+
+static inline void uring_prep_write(struct io_uring_sqe *sqe, int fd, const void *data, ffuint n, ffuint64 off, ffuint64 user_data)
+{
+	uring_prep_rw(sqe, IORING_OP_WRITE, fd, data, n, off, user_data);
+}
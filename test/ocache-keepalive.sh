@@ -0,0 +1,47 @@
+#!/bin/sh
+# alphahttpd: regression test: in-memory cache of complete responses (--mem-cache)
+# Two GET requests for a small file over one keep-alive connection
+#  must both return 200 with the file contents;  the second one must be served from cache.
+# Usage: test/ocache-keepalive.sh [BINARY]
+
+set -e
+BIN=${1:-./alphahttpd}
+PORT=${PORT:-18080}
+DIR=$(mktemp -d)
+PID=
+cleanup() {
+	[ -z "$PID" ] || kill $PID 2>/dev/null || true
+	rm -rf "$DIR"
+}
+trap cleanup EXIT
+
+mkdir "$DIR/www"
+echo "small file" >"$DIR/www/small.txt"
+
+"$BIN" --listen $PORT --www "$DIR/www" --threads 1 --debug >"$DIR/log" 2>&1 &
+PID=$!
+sleep 1
+
+URL=http://127.0.0.1:$PORT/small.txt
+# curl reuses the connection for the second URL:  'num_connects' is 0
+RESULT=$(curl -s -w '%{http_code} %{num_connects}\n' "$URL" -o "$DIR/r1" "$URL" -o "$DIR/r2")
+EXPECT=$(printf '200 1\n200 0')
+if [ "$RESULT" != "$EXPECT" ] ; then
+	echo "FAIL: status/connections: $RESULT"
+	exit 1
+fi
+
+cmp "$DIR/www/small.txt" "$DIR/r1"
+cmp "$DIR/www/small.txt" "$DIR/r2"
+
+if ! grep -q "ocache: hit" "$DIR/log" ; then
+	echo "FAIL: the second response isn't taken from in-memory cache"
+	exit 1
+fi
+
+if grep -q "fffile_open: .*: not found" "$DIR/log" ; then
+	echo "FAIL: unexpected file lookup after the response"
+	exit 1
+fi
+
+echo "OK"
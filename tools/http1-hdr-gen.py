@@ -0,0 +1,68 @@
+#!/usr/bin/env python3
+# alphahttpd: generate the perfect hash for known HTTP/1 header names (src/util/http1-hdr.h)
+# Usage:
+#   tools/http1-hdr-gen.py        check that the hash function and `http_hdr_hashtab` in the header are valid
+#   tools/http1-hdr-gen.py -g     find new coefficients and print the hash expression and the table
+# The names are taken from `http_hdr_names` in the header, and the IDs from `enum HTTP_H`.
+
+import re
+import sys
+
+HDR = __file__.rsplit('/', 2)[0] + '/src/util/http1-hdr.h'
+BITS = 63 # hash mask
+
+def parse(text):
+	ids = re.search(r'enum HTTP_H \{(.*?)\};', text, re.S).group(1)
+	ids = [x for x in re.findall(r'(HTTP_H_\w+),', ids) if x != 'HTTP_H_KNOWN']
+	names = re.search(r'http_hdr_names\[\]\[\d+\] = \{(.*?)\};', text, re.S).group(1)
+	names = re.findall(r'"([^"]+)"', names)
+	if len(ids) != len(names):
+		sys.exit('enum HTTP_H and http_hdr_names differ in size')
+	m = re.search(r'uint h = \(n \+ \(d\[0\] \| 0x20\) \* (\d+) \+ \(d\[n-1\] \| 0x20\) \* (\d+) \+ \(d\[n/2\] \| 0x20\)( \* (\d+))?\) & 63;', text)
+	if m is None:
+		sys.exit('hash expression not found in http_hdr_id()')
+	coef = (int(m.group(1)), int(m.group(2)), int(m.group(4) or 1))
+	tab = dict((int(k), v) for k, v in re.findall(r'\[(\d+)\] = (HTTP_H_\w+) \+ 1,', text))
+	return ids, names, coef, tab
+
+def hash(name, coef):
+	d = [ord(ch) | 0x20 for ch in name]
+	n = len(d)
+	return (n + d[0] * coef[0] + d[n-1] * coef[1] + d[n//2] * coef[2]) & BITS
+
+def build(names, coef):
+	tab = {}
+	for i, name in enumerate(names):
+		h = hash(name, coef)
+		if h in tab:
+			return None
+		tab[h] = i
+	return tab
+
+def main():
+	text = open(HDR).read()
+	ids, names, coef, tab = parse(text)
+
+	if len(sys.argv) > 1 and sys.argv[1] == '-g':
+		for a in range(64):
+			for b in range(64):
+				for c in range(1, 64):
+					t = build(names, (a, b, c))
+					if t is not None:
+						print('uint h = (n + (d[0] | 0x20) * %u + (d[n-1] | 0x20) * %u + (d[n/2] | 0x20) * %u) & 63;' % (a, b, c))
+						print('static const ffbyte http_hdr_hashtab[64] = {')
+						for h in sorted(t):
+							print('\t[%u] = %s + 1,' % (h, ids[t[h]]))
+						print('};')
+						return
+		sys.exit('no coefficients found')
+
+	t = build(names, coef)
+	if t is None:
+		sys.exit('collision: run with -g to find new coefficients')
+	expect = dict((h, ids[i]) for h, i in t.items())
+	if expect != tab:
+		sys.exit('http_hdr_hashtab is out of date: run with -g to regenerate it')
+	print('OK: %u names' % len(names))
+
+main()